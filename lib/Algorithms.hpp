@@ -4,6 +4,8 @@
 #include <algorithm>
 #include <string>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
 
 // Return a sorted list with increasing order
@@ -90,6 +92,50 @@ inline double getNegativeQuadraticScale ( size_t i, size_t count )
 }
 
 
+// Fast non-cryptographic 32-bit hash of a byte range.
+// The main loop runs 4 independent lanes over 16 bytes at a time, so the compiler can vectorize it.
+inline uint32_t hashBytes ( const void *bytes, size_t len, uint32_t seed = 0 )
+{
+    static const uint32_t prime1 = 2654435761U, prime2 = 2246822519U, prime3 = 3266489917U;
+
+    const char *ptr = ( const char * ) bytes;
+    const char *const end = ptr + len;
+
+    uint32_t lanes[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+
+    for ( ; ptr + 16 <= end; ptr += 16 )
+    {
+        uint32_t words[4];
+        memcpy ( words, ptr, 16 );
+
+        for ( size_t i = 0; i < 4; ++i )
+        {
+            lanes[i] += words[i] * prime2;
+            lanes[i] = ( lanes[i] << 13 ) | ( lanes[i] >> 19 );
+            lanes[i] *= prime1;
+        }
+    }
+
+    uint32_t hash = ( ( lanes[0] << 1 ) | ( lanes[0] >> 31 ) ) + ( ( lanes[1] << 7 ) | ( lanes[1] >> 25 ) )
+                    + ( ( lanes[2] << 12 ) | ( lanes[2] >> 20 ) ) + ( ( lanes[3] << 18 ) | ( lanes[3] >> 14 ) );
+
+    hash += len;
+
+    for ( ; ptr < end; ++ptr )
+    {
+        hash += uint8_t ( *ptr ) * prime1;
+        hash = ( ( hash << 11 ) | ( hash >> 21 ) ) * prime2;
+    }
+
+    hash ^= hash >> 15;
+    hash *= prime2;
+    hash ^= hash >> 13;
+    hash *= prime3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+
 // Return the incremented value of x
 template<typename T>
 inline T incremented ( T x )
@@ -2,6 +2,7 @@
 #include "TimerManager.hpp"
 #include "SocketManager.hpp"
 #include "ControllerManager.hpp"
+#include "SharedMemoryPipe.hpp"
 #include "Logger.hpp"
 
 #include <winsock2.h>
@@ -38,6 +39,27 @@ void EventManager::checkEvents ( uint64_t timeout )
             timeout = newTimeout;
     }
 
+    // Shared memory pipes can't wake up select, so limit the timeout while any are active
+    if ( SharedMemoryPipe::isAnyActive() )
+    {
+        SharedMemoryPipe::checkAll();
+
+        if ( ! _running )
+            return;
+
+        ASSERT ( timeout > 0 );
+
+        // Without any sockets, block on the pipes instead
+        if ( SocketManager::get().isEmpty() )
+        {
+            SharedMemoryPipe::waitAll ( timeout );
+            return;
+        }
+
+        if ( timeout > SHARED_MEMORY_POLL_INTERVAL )
+            timeout = SHARED_MEMORY_POLL_INTERVAL;
+    }
+
     ASSERT ( timeout > 0 );
 
     SocketManager::get().check ( timeout );
@@ -0,0 +1,98 @@
+#include "MemCapture.hpp"
+#include "Logger.hpp"
+
+using namespace std;
+
+
+#define MEM_CAPTURE_MAGIC ( 0x50414343 ) // "CCAP"
+
+
+bool MemCaptureWriter::open ( const string& filename, const char *addr, size_t size )
+{
+    close();
+
+    _header.magic = MEM_CAPTURE_MAGIC;
+    _header.addr = ( uint32_t ) addr;
+    _header.size = size;
+    _header.numFrames = 0;
+
+    _addr = addr;
+
+    _fout.open ( filename.c_str(), ofstream::binary | ofstream::trunc );
+
+    if ( ! _fout.good() )
+    {
+        LOG ( "Failed to open '%s'", filename );
+        _fout.close();
+        return false;
+    }
+
+    // The header is rewritten with the final frame count on close
+    _fout.write ( ( const char * ) &_header, sizeof ( _header ) );
+
+    LOG ( "Started capture '%s'; addr=0x%08X; size=%u", filename, _header.addr, size );
+    return true;
+}
+
+void MemCaptureWriter::close()
+{
+    if ( ! _fout.is_open() )
+        return;
+
+    _fout.seekp ( 0 );
+    _fout.write ( ( const char * ) &_header, sizeof ( _header ) );
+    _fout.close();
+
+    LOG ( "Finished capture; numFrames=%u", _header.numFrames );
+}
+
+void MemCaptureWriter::capture ( uint64_t indexedFrame )
+{
+    if ( ! _fout.is_open() )
+        return;
+
+    _fout.write ( ( const char * ) &indexedFrame, sizeof ( indexedFrame ) );
+    _fout.write ( _addr, _header.size );
+
+    ++_header.numFrames;
+}
+
+
+bool MemCaptureReader::open ( const string& filename )
+{
+    _fin.open ( filename.c_str(), ifstream::binary );
+
+    if ( ! _fin.read ( ( char * ) &_header, sizeof ( _header ) ).good() || _header.magic != MEM_CAPTURE_MAGIC )
+    {
+        LOG ( "Invalid capture file '%s'", filename );
+        return false;
+    }
+
+    _frames.resize ( _header.numFrames );
+
+    for ( size_t i = 0; i < _frames.size(); ++i )
+    {
+        _fin.seekg ( getRecordOffset ( i ) );
+
+        if ( ! _fin.read ( ( char * ) &_frames[i], sizeof ( _frames[i] ) ).good() )
+        {
+            LOG ( "Truncated capture file '%s' at record %u", filename, i );
+            _frames.resize ( i );
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool MemCaptureReader::readRecord ( size_t i, char *data )
+{
+    _fin.seekg ( getRecordOffset ( i ) + sizeof ( uint64_t ) );
+
+    return _fin.read ( data, _header.size ).good();
+}
+
+streamoff MemCaptureReader::getRecordOffset ( size_t i ) const
+{
+    return sizeof ( _header ) + streamoff ( i ) * ( sizeof ( uint64_t ) + _header.size );
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+
+// Captures of a contiguous range of memory, one record per frame, used to discover the rollback memory.
+// The file is a MemCaptureHeader, followed by numFrames records of ( uint64_t indexedFrame, size bytes ).
+struct MemCaptureHeader
+{
+    uint32_t magic;
+    uint32_t addr;
+    uint32_t size;
+    uint32_t numFrames;
+};
+
+
+class MemCaptureWriter
+{
+public:
+
+    ~MemCaptureWriter() { close(); }
+
+    // Start a new capture file of the given memory range
+    bool open ( const std::string& filename, const char *addr, size_t size );
+
+    // Finish writing the header and close the file
+    void close();
+
+    bool isOpen() const { return _fout.is_open(); }
+
+    // Append the current contents of the memory range
+    void capture ( uint64_t indexedFrame );
+
+    uint32_t getNumFrames() const { return _header.numFrames; }
+
+private:
+
+    std::ofstream _fout;
+
+    MemCaptureHeader _header;
+
+    // Start of the memory range
+    const char *_addr = 0;
+};
+
+
+class MemCaptureReader
+{
+public:
+
+    // Open a capture file and read the frame of each record
+    bool open ( const std::string& filename );
+
+    const MemCaptureHeader& getHeader() const { return _header; }
+
+    // The frame of each record, in the order captured
+    const std::vector<uint64_t>& getFrames() const { return _frames; }
+
+    // Read the memory of the given record, data must be getHeader().size bytes.
+    // Each reader has its own file position, so use one reader per thread.
+    bool readRecord ( size_t i, char *data );
+
+private:
+
+    std::ifstream _fin;
+
+    MemCaptureHeader _header;
+
+    std::vector<uint64_t> _frames;
+
+    std::streamoff getRecordOffset ( size_t i ) const;
+};
@@ -121,6 +121,147 @@ void MemDumpList::update()
     totalSize = 0;
     for ( const MemDump& mem : addrs )
         totalSize += mem.getTotalSize();
+
+    compile();
+}
+
+void MemDumpList::compile()
+{
+    _copyOps.clear();
+    _ptrOps.clear();
+    _regionOffsets.clear();
+    _ptrSlots.clear();
+
+    size_t offset = 0;
+
+    for ( const MemDump& mem : addrs )
+    {
+        _regionOffsets.push_back ( offset );
+
+        // Merge with the previous op if both the addresses and the dump offsets are continuous
+        if ( ! _copyOps.empty()
+                && _copyOps.back().addr + _copyOps.back().size == mem.addr
+                && _copyOps.back().offset + _copyOps.back().size == offset )
+        {
+            _copyOps.back().size += mem.size;
+        }
+        else
+        {
+            _copyOps.push_back ( { mem.addr, offset, mem.size } );
+        }
+
+        offset += mem.size;
+
+        compilePtrs ( mem.ptrs, mem.addr, NoParent, _regionOffsets.back(), offset );
+    }
+
+    ASSERT ( offset == totalSize );
+
+    _regionOffsets.push_back ( offset );
+
+    sort ( _ptrSlots.begin(), _ptrSlots.end() );
+
+    _ptrAddrs.resize ( _ptrOps.size() );
+
+    LOG ( "copyOps=%u; ptrOps=%u; totalSize=%u", _copyOps.size(), _ptrOps.size(), totalSize );
+}
+
+void MemDumpList::compilePtrs ( const vector<MemDumpPtr>& ptrs, char *base, uint32_t parent, size_t parentOffset,
+                               size_t& offset )
+{
+    for ( const MemDumpPtr& ptr : ptrs )
+    {
+        ASSERT ( ptr.srcOffset + sizeof ( char * ) <= ptr.parent->size );
+
+        const uint32_t index = _ptrOps.size();
+        const size_t ptrOffset = offset;
+
+        _ptrOps.push_back ( { base, parent, ptr.srcOffset, ptr.dstOffset, ptrOffset, ptr.size } );
+
+        // The pointer value is saved as part of the parent
+        _ptrSlots.push_back ( parentOffset + ptr.srcOffset );
+
+        offset += ptr.size;
+
+        compilePtrs ( ptr.ptrs, 0, index, ptrOffset, offset );
+    }
+}
+
+inline char *MemDumpList::resolvePtr ( const PtrOp& op ) const
+{
+    const char *parentAddr = ( op.parent == NoParent ? op.base : _ptrAddrs[op.parent] );
+
+    if ( parentAddr == 0 )
+        return 0;
+
+    char *dstAddr = * ( char ** ) ( parentAddr + op.srcOffset );
+
+    if ( dstAddr == 0 )
+        return 0;
+
+    return dstAddr + op.dstOffset;
+}
+
+void MemDumpList::saveDump ( char *dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    for ( const CopyOp& op : _copyOps )
+        memcpy ( dump + op.offset, op.addr, op.size );
+
+    for ( size_t i = 0; i < _ptrOps.size(); ++i )
+    {
+        const PtrOp& op = _ptrOps[i];
+        char *addr = _ptrAddrs[i] = resolvePtr ( op );
+
+        if ( addr )
+            memcpy ( dump + op.offset, addr, op.size );
+        else
+            memset ( dump + op.offset, 0, op.size );
+    }
+}
+
+void MemDumpList::hashRegions ( const char *dump, uint32_t *hashes ) const
+{
+    auto slot = _ptrSlots.cbegin();
+
+    for ( size_t i = 0; i + 1 < _regionOffsets.size(); ++i )
+    {
+        size_t pos = _regionOffsets[i];
+        const size_t end = _regionOffsets[i + 1];
+
+        uint32_t hash = 0;
+
+        // Hash the bytes between each pointer value
+        for ( ; slot != _ptrSlots.cend() && *slot < end; ++slot )
+        {
+            if ( *slot >= pos )
+            {
+                hash = hashBytes ( dump + pos, *slot - pos, hash );
+                pos = *slot + sizeof ( char * );
+            }
+        }
+
+        hashes[i] = hashBytes ( dump + pos, end - pos, hash );
+    }
+}
+
+void MemDumpList::loadDump ( const char *dump ) const
+{
+    ASSERT ( dump != 0 );
+
+    // Static ranges are loaded first, so pointers are resolved using the loaded values, same as MemDumpBase::loadDump
+    for ( const CopyOp& op : _copyOps )
+        memcpy ( op.addr, dump + op.offset, op.size );
+
+    for ( size_t i = 0; i < _ptrOps.size(); ++i )
+    {
+        const PtrOp& op = _ptrOps[i];
+        char *addr = _ptrAddrs[i] = resolvePtr ( op );
+
+        if ( addr )
+            memcpy ( addr, dump + op.offset, op.size );
+    }
 }
 
 void MemDumpBase::save ( BinaryOutputArchive& ar ) const
@@ -185,6 +326,8 @@ void MemDumpList::load ( BinaryInputArchive& ar )
         else
             append ( { ( char * ) addr, size } );
     }
+
+    compile();
 }
 
 bool MemDumpList::save ( const string& filename ) const
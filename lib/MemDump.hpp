@@ -177,6 +177,11 @@ public:
     {
         totalSize = 0;
         addrs.clear();
+        _copyOps.clear();
+        _ptrOps.clear();
+        _ptrAddrs.clear();
+        _regionOffsets.clear();
+        _ptrSlots.clear();
     }
 
     // True only if addrs.empty()
@@ -211,13 +216,87 @@ public:
             append ( addr, addAddrOffset );
     }
 
-    // Update the list of memory dumps: merge continuous address ranges, then compute total size
+    // Update the list of memory dumps: merge continuous address ranges, then compute total size and the copy plan
     void update();
 
+    // Save / load all memory dumps to / from a buffer of totalSize bytes, using the copy plan.
+    // This produces the same layout as calling MemDumpBase::saveDump / loadDump on each of addrs in order.
+    void saveDump ( char *dump ) const;
+    void loadDump ( const char *dump ) const;
+
+    // Each of addrs is one region, which is stored continuously in the dump, including its pointers.
+    // Get the offset of a region in the dump buffer, and the size of a region.
+    size_t getRegionOffset ( size_t region ) const { return _regionOffsets[region]; }
+    size_t getRegionSize ( size_t region ) const { return _regionOffsets[region + 1] - _regionOffsets[region]; }
+
+    // Hash each region of a dump buffer, hashes must have space for addrs.size() values.
+    // The pointer values are skipped, since heap addresses differ between processes.
+    void hashRegions ( const char *dump, uint32_t *hashes ) const;
+
     // Serialization
     void save ( cereal::BinaryOutputArchive& ar ) const;
     void load ( cereal::BinaryInputArchive& ar );
     bool save ( const std::string& filename ) const;
     bool load ( const std::string& filename );
     bool load ( const char *data, size_t size );
+
+private:
+
+    // Indicates a pointer whose parent is a static address
+    static const uint32_t NoParent = UINT32_MAX;
+
+    // Copy a static address range, contiguous ranges are merged into a single op
+    struct CopyOp
+    {
+        // Starting address
+        char *addr;
+
+        // Offset into the dump buffer
+        size_t offset;
+
+        // Number of bytes to copy
+        size_t size;
+    };
+
+    // Copy the memory pointed to by a pointer, which is resolved again each time the plan is run
+    struct PtrOp
+    {
+        // Address of the parent if it is static, otherwise 0
+        char *base;
+
+        // Index of the parent pointer op if it isn't static, otherwise NoParent
+        uint32_t parent;
+
+        // Same as MemDumpPtr
+        size_t srcOffset, dstOffset;
+
+        // Offset into the dump buffer
+        size_t offset;
+
+        // Number of bytes to copy
+        size_t size;
+    };
+
+    // The copy plan: all static ranges, then all pointers ordered so each parent comes before its children
+    std::vector<CopyOp> _copyOps;
+    std::vector<PtrOp> _ptrOps;
+
+    // Resolved address of each pointer op, only used while running the plan
+    mutable std::vector<char *> _ptrAddrs;
+
+    // Offset of each region in the dump buffer, followed by totalSize
+    std::vector<size_t> _regionOffsets;
+
+    // Sorted offsets of the pointer values in the dump buffer
+    std::vector<size_t> _ptrSlots;
+
+    // Compile the copy plan from addrs
+    void compile();
+
+    // Compile the pointer ops for a list of child pointers, in depth first order
+    void compilePtrs ( const std::vector<MemDumpPtr>& ptrs, char *base, uint32_t parent, size_t parentOffset,
+                       size_t& offset );
+
+    // Get the address of a pointer op, using the already resolved address of its parent
+    char *resolvePtr ( const PtrOp& op ) const;
 };
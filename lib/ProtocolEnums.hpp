@@ -32,3 +32,7 @@ VersionConfig,
 JoysticksChanged,
 TransitionIndex,
 PaletteManager,
+StateHashes,
+SpectatorSubtree,
+SpectatorDepth,
+SpectatorKeyframe,
@@ -0,0 +1,288 @@
+#include "SaveStateFile.hpp"
+#include "Logger.hpp"
+
+#include <windows.h>
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+
+#define SAVE_STATE_FILE_MAGIC       ( 0x53534343 ) // "CCSS"
+
+#define SAVE_STATE_FILE_VERSION     ( 1 )
+
+// Records are aligned so the headers can be read in place
+#define RECORD_ALIGNMENT            ( 8 )
+
+
+static uint64_t alignRecord ( uint64_t offset )
+{
+    return ( offset + RECORD_ALIGNMENT - 1 ) & ~uint64_t ( RECORD_ALIGNMENT - 1 );
+}
+
+// Views must start at a multiple of this
+static uint64_t getAllocationGranularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo ( &info );
+    return info.dwAllocationGranularity;
+}
+
+
+bool SaveStateFile::open ( const string& filename, uint32_t layoutHash )
+{
+    close();
+
+    HANDLE file = CreateFile ( filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, 0,
+                               OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0 );
+
+    if ( file == INVALID_HANDLE_VALUE )
+    {
+        LOG ( "Failed to open '%s'; error=%d", filename, GetLastError() );
+        return false;
+    }
+
+    _file = file;
+
+    LARGE_INTEGER fileSize;
+
+    if ( ! GetFileSizeEx ( file, &fileSize ) )
+        fileSize.QuadPart = 0;
+
+    if ( ( uint64_t ) fileSize.QuadPart < sizeof ( FileHeader )
+            || ! readAt ( 0, &_header, sizeof ( _header ) )
+            || _header.magic != SAVE_STATE_FILE_MAGIC
+            || _header.version != SAVE_STATE_FILE_VERSION
+            || _header.layoutHash != layoutHash
+            || _header.dataEnd > ( uint64_t ) fileSize.QuadPart )
+    {
+        LOG ( "Starting new savestate file '%s'", filename );
+
+        _header.magic = SAVE_STATE_FILE_MAGIC;
+        _header.version = SAVE_STATE_FILE_VERSION;
+        _header.layoutHash = layoutHash;
+        _header.reserved = 0;
+        _header.dataEnd = alignRecord ( sizeof ( FileHeader ) );
+    }
+
+    scan();
+
+    // Drop anything after the last complete record
+    LARGE_INTEGER pos;
+    pos.QuadPart = _header.dataEnd;
+
+    if ( ! writeHeader()
+            || ! SetFilePointerEx ( file, pos, 0, FILE_BEGIN )
+            || ! SetEndOfFile ( file ) )
+    {
+        LOG ( "Failed to truncate '%s'; error=%d", filename, GetLastError() );
+        close();
+        return false;
+    }
+
+    LOG ( "Opened savestate file '%s'; records=%u; dataEnd=%llu", filename, _index.size(), _header.dataEnd );
+    return true;
+}
+
+void SaveStateFile::close()
+{
+    if ( ! _file )
+        return;
+
+    unmapRecord();
+
+    if ( _mapping )
+    {
+        CloseHandle ( ( HANDLE ) _mapping );
+        _mapping = 0;
+    }
+
+    _mappingSize = 0;
+
+    CloseHandle ( ( HANDLE ) _file );
+    _file = 0;
+
+    _index.clear();
+}
+
+bool SaveStateFile::writeHeader()
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = 0;
+
+    DWORD written = 0;
+
+    if ( ! SetFilePointerEx ( ( HANDLE ) _file, pos, 0, FILE_BEGIN )
+            || ! WriteFile ( ( HANDLE ) _file, &_header, sizeof ( _header ), &written, 0 )
+            || written != sizeof ( _header ) )
+    {
+        LOG ( "Failed to write header; error=%d", GetLastError() );
+        return false;
+    }
+
+    return true;
+}
+
+bool SaveStateFile::readAt ( uint64_t offset, void *bytes, size_t size )
+{
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+
+    DWORD read = 0;
+
+    return ( SetFilePointerEx ( ( HANDLE ) _file, pos, 0, FILE_BEGIN )
+             && ReadFile ( ( HANDLE ) _file, bytes, size, &read, 0 )
+             && read == size );
+}
+
+void SaveStateFile::scan()
+{
+    _index.clear();
+
+    uint64_t offset = alignRecord ( sizeof ( FileHeader ) );
+
+    while ( offset + sizeof ( RecordHeader ) <= _header.dataEnd )
+    {
+        RecordHeader record;
+
+        if ( ! readAt ( offset, &record, sizeof ( record ) ) )
+            break;
+
+        const uint64_t end = offset + sizeof ( RecordHeader ) + record.metaSize + record.imageSize;
+
+        if ( end > _header.dataEnd )
+            break;
+
+        _index[record.key] = { offset, record.metaSize, record.imageSize };
+        offset = alignRecord ( end );
+    }
+
+    _header.dataEnd = min ( _header.dataEnd, offset );
+}
+
+char *SaveStateFile::mapRecord ( uint64_t offset, uint64_t size )
+{
+    unmapRecord();
+
+    const uint64_t end = offset + size;
+
+    if ( end > _mappingSize )
+    {
+        if ( _mapping )
+            CloseHandle ( ( HANDLE ) _mapping );
+
+        _mappingSize = 0;
+
+        _mapping = CreateFileMapping ( ( HANDLE ) _file, 0, PAGE_READWRITE, end >> 32, end & 0xFFFFFFFF, 0 );
+
+        if ( ! _mapping )
+        {
+            LOG ( "CreateFileMapping failed; size=%llu; error=%d", end, GetLastError() );
+            return 0;
+        }
+
+        _mappingSize = end;
+    }
+
+    static const uint64_t granularity = getAllocationGranularity();
+
+    const uint64_t base = offset - offset % granularity;
+
+    _recordView = ( char * ) MapViewOfFile ( ( HANDLE ) _mapping, FILE_MAP_ALL_ACCESS,
+                                             base >> 32, base & 0xFFFFFFFF, end - base );
+
+    if ( ! _recordView )
+    {
+        LOG ( "MapViewOfFile failed; offset=%llu; size=%llu; error=%d", offset, size, GetLastError() );
+        return 0;
+    }
+
+    return _recordView + ( offset - base );
+}
+
+void SaveStateFile::unmapRecord()
+{
+    if ( ! _recordView )
+        return;
+
+    UnmapViewOfFile ( _recordView );
+    _recordView = 0;
+}
+
+bool SaveStateFile::append ( uint64_t key, const void *meta, size_t metaSize, const void *image, size_t imageSize )
+{
+    if ( ! _file )
+        return false;
+
+    const uint64_t offset = _header.dataEnd;
+    const uint64_t size = sizeof ( RecordHeader ) + metaSize + imageSize;
+
+    // Map up to the next record, so the file always ends at dataEnd
+    char *view = mapRecord ( offset, alignRecord ( size ) );
+
+    if ( ! view )
+        return false;
+
+    RecordHeader& record = * ( RecordHeader * ) view;
+    record.key = key;
+    record.metaSize = metaSize;
+    record.imageSize = imageSize;
+
+    memcpy ( view + sizeof ( RecordHeader ), meta, metaSize );
+    memcpy ( view + sizeof ( RecordHeader ) + metaSize, image, imageSize );
+
+    unmapRecord();
+
+    // Commit the record, a partially written record is dropped the next time the file is opened
+    _header.dataEnd = alignRecord ( offset + size );
+
+    if ( ! writeHeader() )
+        return false;
+
+    _index[key] = { offset, uint32_t ( metaSize ), uint32_t ( imageSize ) };
+    return true;
+}
+
+bool SaveStateFile::find ( uint64_t key, const char *& meta, size_t& metaSize, const char *& image, size_t& imageSize )
+{
+    const auto it = _index.find ( key );
+
+    if ( it == _index.end() )
+        return false;
+
+    const RecordInfo& info = it->second;
+    const char *view = mapRecord ( info.offset, sizeof ( RecordHeader ) + info.metaSize + info.imageSize );
+
+    if ( ! view )
+        return false;
+
+    meta = view + sizeof ( RecordHeader );
+    metaSize = info.metaSize;
+    image = meta + metaSize;
+    imageSize = info.imageSize;
+    return true;
+}
+
+bool SaveStateFile::findAtOrBefore ( uint64_t key, uint64_t& found ) const
+{
+    auto it = _index.upper_bound ( key );
+
+    if ( it == _index.begin() )
+        return false;
+
+    found = ( --it )->first;
+    return true;
+}
+
+vector<uint64_t> SaveStateFile::getKeys() const
+{
+    vector<uint64_t> keys;
+    keys.reserve ( _index.size() );
+
+    for ( const auto& kv : _index )
+        keys.push_back ( kv.first );
+
+    return keys;
+}
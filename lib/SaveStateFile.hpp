@@ -0,0 +1,98 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// Append-only file of savestate records, only the record being read or written is mapped.
+// Each record has a 64-bit key, a small metadata blob, and a raw memory image.
+// The file header has a layout hash, so records are only kept if they were written with the same memory layout.
+// The index of keys is rebuilt by scanning the records when the file is opened; a newer record with the same key
+// replaces the older one in the index, but the file itself is never rewritten.
+class SaveStateFile
+{
+public:
+
+    ~SaveStateFile() { close(); }
+
+    // Open or create the file. Existing records are discarded if the layout hash doesn't match.
+    bool open ( const std::string& filename, uint32_t layoutHash );
+
+    // Unmap and close the file
+    void close();
+
+    bool isOpen() const { return ( _file != 0 ); }
+
+    // Append a record, returns false if the file couldn't be grown
+    bool append ( uint64_t key, const void *meta, size_t metaSize, const void *image, size_t imageSize );
+
+    // Get a record by key, the pointers are into the mapped record, and are valid until the next find, append or close
+    bool find ( uint64_t key, const char *& meta, size_t& metaSize, const char *& image, size_t& imageSize );
+
+    // Get the key of the newest record at or before the given key
+    bool findAtOrBefore ( uint64_t key, uint64_t& found ) const;
+
+    // Get all the keys in order
+    std::vector<uint64_t> getKeys() const;
+
+    // Number of indexed records
+    size_t size() const { return _index.size(); }
+
+private:
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t layoutHash;
+        uint32_t reserved;
+
+        // End of the last complete record, this is only updated after the record is written
+        uint64_t dataEnd;
+    };
+
+    struct RecordHeader
+    {
+        uint64_t key;
+        uint32_t metaSize;
+        uint32_t imageSize;
+    };
+
+    // Location of an indexed record
+    struct RecordInfo
+    {
+        uint64_t offset;
+        uint32_t metaSize;
+        uint32_t imageSize;
+    };
+
+    // File and mapping handles
+    void *_file = 0;
+    void *_mapping = 0;
+
+    // Size of the file mapping, the mapping is recreated when the file grows past it
+    uint64_t _mappingSize = 0;
+
+    // View of the currently mapped record
+    char *_recordView = 0;
+
+    // Copy of the file header
+    FileHeader _header;
+
+    // Map of key to record
+    std::map<uint64_t, RecordInfo> _index;
+
+    // Read / write the file at the given offset
+    bool readAt ( uint64_t offset, void *bytes, size_t size );
+    bool writeHeader();
+
+    // Rebuild the index from the records, dropping any incomplete record at the end
+    void scan();
+
+    // Map the given range of the file, growing the file if needed. Only one range is mapped at a time.
+    char *mapRecord ( uint64_t offset, uint64_t size );
+    void unmapRecord();
+};
@@ -0,0 +1,340 @@
+#include "SharedMemoryPipe.hpp"
+#include "Logger.hpp"
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+
+// Size of the length prefix before each message in the ring
+#define FRAME_HEADER_SIZE   ( sizeof ( uint32_t ) )
+
+// Total size of one ring buffer in the mapping, including the header
+#define RING_TOTAL_SIZE     ( sizeof ( RingHeader ) + SHARED_MEMORY_RING_SIZE )
+
+// Mask for wrapping ring positions
+#define RING_MASK           ( SHARED_MEMORY_RING_SIZE - 1 )
+
+static_assert ( ( SHARED_MEMORY_RING_SIZE & RING_MASK ) == 0, "SHARED_MEMORY_RING_SIZE must be a power of 2" );
+
+
+unordered_set<SharedMemoryPipe *> SharedMemoryPipe::_activePipes;
+
+
+// Copy into the ring starting at the given position, wrapping around the end
+static void ringWrite ( char *ring, uint32_t pos, const char *bytes, size_t len )
+{
+    const size_t offset = ( pos & RING_MASK );
+    const size_t first = min ( len, SHARED_MEMORY_RING_SIZE - offset );
+
+    memcpy ( ring + offset, bytes, first );
+
+    if ( first < len )
+        memcpy ( ring, bytes + first, len - first );
+}
+
+// Copy out of the ring starting at the given position, wrapping around the end
+static void ringRead ( const char *ring, uint32_t pos, char *bytes, size_t len )
+{
+    const size_t offset = ( pos & RING_MASK );
+    const size_t first = min ( len, SHARED_MEMORY_RING_SIZE - offset );
+
+    memcpy ( bytes, ring + offset, first );
+
+    if ( first < len )
+        memcpy ( bytes + first, ring, len - first );
+}
+
+
+SharedMemoryPipePtr SharedMemoryPipe::create ( Owner *owner, const string& name )
+{
+    SharedMemoryPipePtr pipe ( new SharedMemoryPipe ( owner, name, true ) );
+
+    if ( ! pipe->_view )
+        return 0;
+
+    return pipe;
+}
+
+SharedMemoryPipePtr SharedMemoryPipe::open ( Owner *owner, const string& name )
+{
+    SharedMemoryPipePtr pipe ( new SharedMemoryPipe ( owner, name, false ) );
+
+    if ( ! pipe->_view )
+        return 0;
+
+    return pipe;
+}
+
+SharedMemoryPipe::SharedMemoryPipe ( Owner *owner, const string& name, bool isCreator )
+    : owner ( owner ), name ( name )
+{
+    if ( isCreator )
+    {
+        _mapping = CreateFileMapping ( INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, 2 * RING_TOTAL_SIZE, name.c_str() );
+
+        if ( _mapping && GetLastError() == ERROR_ALREADY_EXISTS )
+        {
+            LOG ( "Shared memory '%s' already exists", name );
+            CloseHandle ( ( HANDLE ) _mapping );
+            _mapping = 0;
+        }
+    }
+    else
+    {
+        _mapping = OpenFileMapping ( FILE_MAP_ALL_ACCESS, FALSE, name.c_str() );
+    }
+
+    if ( ! _mapping )
+    {
+        LOG ( "Failed to %s shared memory '%s'; error=%d", ( isCreator ? "create" : "open" ), name, GetLastError() );
+        return;
+    }
+
+    char *view = ( char * ) MapViewOfFile ( ( HANDLE ) _mapping, FILE_MAP_ALL_ACCESS, 0, 0, 2 * RING_TOTAL_SIZE );
+
+    if ( ! view )
+    {
+        LOG ( "MapViewOfFile failed; error=%d", GetLastError() );
+        CloseHandle ( ( HANDLE ) _mapping );
+        _mapping = 0;
+        return;
+    }
+
+    // The creator writes to the first ring and reads from the second, the opener does the opposite
+    char *const rings[2] = { view, view + RING_TOTAL_SIZE };
+    const size_t writeRing = ( isCreator ? 0 : 1 );
+    const size_t readRing = 1 - writeRing;
+
+    _writeHeader = ( RingHeader * ) rings[writeRing];
+    _writeData = rings[writeRing] + sizeof ( RingHeader );
+    _readHeader = ( RingHeader * ) rings[readRing];
+    _readData = rings[readRing] + sizeof ( RingHeader );
+
+    // Event names must match on both sides, so they're indexed by ring, not by direction
+    const string writeEventName = format ( "%s_%u", name, writeRing );
+    const string readEventName = format ( "%s_%u", name, readRing );
+
+    _writeEvent = CreateEvent ( 0, FALSE, FALSE, writeEventName.c_str() );
+    _readEvent = CreateEvent ( 0, FALSE, FALSE, readEventName.c_str() );
+
+    if ( ! _writeEvent || ! _readEvent )
+    {
+        LOG ( "CreateEvent failed; error=%d", GetLastError() );
+        UnmapViewOfFile ( view );
+        return;
+    }
+
+    // A fresh mapping is zero initialized, so only the process ID needs to be published
+    _writeHeader->processId = GetCurrentProcessId();
+    MemoryBarrier();
+
+    _view = view;
+
+    LOG ( "pipe=%08x; name='%s'; isCreator=%u", this, name, isCreator );
+
+    _activePipes.insert ( this );
+}
+
+SharedMemoryPipe::~SharedMemoryPipe()
+{
+    _activePipes.erase ( this );
+
+    if ( _view )
+    {
+        _writeHeader->closed = 1;
+        MemoryBarrier();
+        SetEvent ( ( HANDLE ) _writeEvent );
+
+        UnmapViewOfFile ( _view );
+        _view = 0;
+    }
+
+    for ( void *handle : { _readEvent, _writeEvent, _peerProcess, _mapping } )
+    {
+        if ( handle )
+            CloseHandle ( ( HANDLE ) handle );
+    }
+}
+
+bool SharedMemoryPipe::isConnected() const
+{
+    return ( _view && ! _disconnected );
+}
+
+bool SharedMemoryPipe::writeFrame ( const string& bytes )
+{
+    const uint32_t writePos = _writeHeader->writePos;
+    const uint32_t readPos = _writeHeader->readPos;
+    MemoryBarrier();
+
+    const uint32_t length = bytes.size();
+
+    if ( SHARED_MEMORY_RING_SIZE - ( writePos - readPos ) < FRAME_HEADER_SIZE + length )
+        return false;
+
+    ringWrite ( _writeData, writePos, ( const char * ) &length, FRAME_HEADER_SIZE );
+    ringWrite ( _writeData, writePos + FRAME_HEADER_SIZE, &bytes[0], length );
+
+    // Publish the data before the new write position
+    MemoryBarrier();
+    _writeHeader->writePos = writePos + FRAME_HEADER_SIZE + length;
+    return true;
+}
+
+bool SharedMemoryPipe::send ( const MsgPtr& msg )
+{
+    if ( ! isConnected() )
+        return false;
+
+    const string bytes = Protocol::encode ( msg );
+
+    if ( bytes.empty() )
+        return true;
+
+    if ( FRAME_HEADER_SIZE + bytes.size() > SHARED_MEMORY_RING_SIZE )
+    {
+        LOG ( "Message too large for shared memory pipe: %s; size=%u", msg, bytes.size() );
+        return false;
+    }
+
+    // Preserve message order if anything is already waiting
+    if ( ! _pending.empty() || ! writeFrame ( bytes ) )
+    {
+        _pending.push_back ( bytes );
+        return true;
+    }
+
+    SetEvent ( ( HANDLE ) _writeEvent );
+    return true;
+}
+
+void SharedMemoryPipe::check()
+{
+    if ( ! isConnected() )
+        return;
+
+    // Flush any messages that didn't fit last time
+    if ( ! _pending.empty() )
+    {
+        while ( ! _pending.empty() && writeFrame ( _pending.front() ) )
+            _pending.pop_front();
+
+        SetEvent ( ( HANDLE ) _writeEvent );
+    }
+
+    if ( ! _peerProcess && _readHeader->processId )
+        _peerProcess = OpenProcess ( SYNCHRONIZE, FALSE, _readHeader->processId );
+
+    // Only touch the read ring if the doorbell was rung
+    if ( WaitForSingleObject ( ( HANDLE ) _readEvent, 0 ) == WAIT_OBJECT_0 )
+    {
+        for ( ;; )
+        {
+            const uint32_t readPos = _readHeader->readPos;
+            const uint32_t writePos = _readHeader->writePos;
+            MemoryBarrier();
+
+            if ( writePos - readPos < FRAME_HEADER_SIZE )
+                break;
+
+            uint32_t length;
+            ringRead ( _readData, readPos, ( char * ) &length, FRAME_HEADER_SIZE );
+
+            if ( writePos - readPos < FRAME_HEADER_SIZE + length )
+                break;
+
+            _readBuffer.resize ( length );
+            ringRead ( _readData, readPos + FRAME_HEADER_SIZE, &_readBuffer[0], length );
+
+            // Release the space before dispatching, since the owner may send a reply
+            MemoryBarrier();
+            _readHeader->readPos = readPos + FRAME_HEADER_SIZE + length;
+
+            size_t consumed;
+            MsgPtr msg = Protocol::decode ( &_readBuffer[0], length, consumed );
+
+            if ( ! msg || consumed != length )
+            {
+                LOG ( "Failed to decode [ %u bytes ]", length );
+                continue;
+            }
+
+            // The owner may destroy this pipe during the callback
+            if ( owner )
+                owner->pipeRead ( this, msg );
+
+            if ( _activePipes.find ( this ) == _activePipes.end() || ! isConnected() )
+                return;
+        }
+    }
+
+    if ( _readHeader->closed
+            || ( _peerProcess && WaitForSingleObject ( ( HANDLE ) _peerProcess, 0 ) == WAIT_OBJECT_0 ) )
+    {
+        disconnect();
+    }
+}
+
+void SharedMemoryPipe::disconnect()
+{
+    LOG ( "pipe=%08x; name='%s' disconnected", this, name );
+
+    _disconnected = true;
+
+    if ( owner )
+        owner->pipeDisconnected ( this );
+}
+
+void SharedMemoryPipe::checkAll()
+{
+    if ( _activePipes.empty() )
+        return;
+
+    // Copy since pipes may be destroyed during the callbacks
+    const vector<SharedMemoryPipe *> pipes ( _activePipes.begin(), _activePipes.end() );
+
+    for ( SharedMemoryPipe *pipe : pipes )
+    {
+        if ( _activePipes.find ( pipe ) == _activePipes.end() )
+            continue;
+
+        pipe->check();
+    }
+}
+
+void SharedMemoryPipe::waitAll ( uint64_t timeout )
+{
+    // Read events first, then the other processes, so the signalled read event can be found by index
+    vector<HANDLE> handles;
+
+    for ( SharedMemoryPipe *pipe : _activePipes )
+    {
+        if ( pipe->isConnected() )
+            handles.push_back ( ( HANDLE ) pipe->_readEvent );
+    }
+
+    const size_t numReadEvents = handles.size();
+
+    for ( SharedMemoryPipe *pipe : _activePipes )
+    {
+        if ( pipe->isConnected() && pipe->_peerProcess )
+            handles.push_back ( ( HANDLE ) pipe->_peerProcess );
+    }
+
+    if ( handles.empty() || handles.size() > MAXIMUM_WAIT_OBJECTS )
+    {
+        Sleep ( timeout );
+        return;
+    }
+
+    const DWORD result = WaitForMultipleObjects ( handles.size(), &handles[0], FALSE, timeout );
+
+    // The read events are auto-reset, so signal it again for the next check
+    if ( result >= WAIT_OBJECT_0 && result < WAIT_OBJECT_0 + numReadEvents )
+        SetEvent ( handles[result - WAIT_OBJECT_0] );
+}
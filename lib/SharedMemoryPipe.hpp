@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Protocol.hpp"
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <unordered_set>
+
+
+// Capacity of each ring buffer in bytes, must be a power of 2
+#define SHARED_MEMORY_RING_SIZE     ( 1024 * 1024 )
+
+// Maximum time to block in select while a pipe is active, in milliseconds
+#define SHARED_MEMORY_POLL_INTERVAL ( 1 )
+
+
+class SharedMemoryPipe;
+
+typedef std::shared_ptr<SharedMemoryPipe> SharedMemoryPipePtr;
+
+
+// Message pipe between two processes over a named shared memory mapping.
+// The mapping holds two single-producer / single-consumer lock-free ring buffers, one for each direction.
+// Each ring has a named auto-reset event that is signalled after every write, so the reader can cheaply
+// check for new data without touching the shared memory.
+class SharedMemoryPipe
+{
+public:
+
+    // Pipe owner interface
+    struct Owner
+    {
+        // Pipe disconnected event, either the other side closed the pipe or the other process exited
+        virtual void pipeDisconnected ( SharedMemoryPipe *pipe ) = 0;
+
+        // Pipe protocol message read event
+        virtual void pipeRead ( SharedMemoryPipe *pipe, const MsgPtr& msg ) = 0;
+    };
+
+    // Pipe owner
+    Owner *owner = 0;
+
+    // Name of the shared memory mapping
+    const std::string name;
+
+    // Create a new named pipe, this is the side that owns the mapping
+    static SharedMemoryPipePtr create ( Owner *owner, const std::string& name );
+
+    // Open an existing named pipe
+    static SharedMemoryPipePtr open ( Owner *owner, const std::string& name );
+
+    // Destructor, marks the pipe as closed for the other side
+    ~SharedMemoryPipe();
+
+    // Indicates if the pipe is still usable
+    bool isConnected() const;
+
+    // Send a protocol message, a return value of false indicates the pipe is disconnected.
+    // Messages that don't fit in the ring buffer are queued and flushed on the next check.
+    bool send ( const MsgPtr& msg );
+    bool send ( Serializable *msg ) { return send ( MsgPtr ( msg ) ); }
+    bool send ( const Serializable& msg ) { return send ( MsgPtr ( const_cast<Serializable *> ( &msg ), ignoreMsgPtr ) ); }
+
+    // Check all active pipes for new messages, called from the EventManager
+    static void checkAll();
+
+    // Block until any active pipe has new messages or is disconnected, or until the timeout in milliseconds
+    static void waitAll ( uint64_t timeout );
+
+    // Indicates if there are any active pipes, the EventManager limits its select timeout while this is true
+    static bool isAnyActive() { return !_activePipes.empty(); }
+
+private:
+
+    // Shared ring buffer header, positions are free running byte counts
+    struct RingHeader
+    {
+        volatile uint32_t readPos;
+        volatile uint32_t writePos;
+        volatile uint32_t closed;
+        volatile uint32_t processId;
+    };
+
+    // All currently allocated pipes
+    static std::unordered_set<SharedMemoryPipe *> _activePipes;
+
+    // Mapping handle and view
+    void *_mapping = 0;
+    char *_view = 0;
+
+    // Doorbell events for reading and writing
+    void *_readEvent = 0;
+    void *_writeEvent = 0;
+
+    // Handle to the other process, opened once it has written its process ID
+    void *_peerProcess = 0;
+
+    // Ring buffers for reading and writing
+    RingHeader *_readHeader = 0;
+    RingHeader *_writeHeader = 0;
+    char *_readData = 0;
+    char *_writeData = 0;
+
+    // Messages waiting for space in the write ring
+    std::deque<std::string> _pending;
+
+    // Buffer for reassembling messages that wrap around the end of the read ring
+    std::string _readBuffer;
+
+    // Disconnected flag
+    bool _disconnected = false;
+
+    // Private constructor, use create or open
+    SharedMemoryPipe ( Owner *owner, const std::string& name, bool isCreator );
+
+    // Try to write a length prefixed frame into the write ring, returns false if there isn't enough space
+    bool writeFrame ( const std::string& bytes );
+
+    // Flush pending messages, read all available messages, and check for disconnection
+    void check();
+
+    // Disconnect and notify the owner
+    void disconnect();
+};
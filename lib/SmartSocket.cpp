@@ -337,7 +337,7 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
     ASSERT ( socket == _vpsSocket.get() );
 
     _vpsSocket->_readPos += len;
-    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", len, address, _vpsSocket->_readPos );
+    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", len, address, _vpsSocket->getReadLength() );
 
     if ( len > 0 && len <= 256 )
         LOG ( "Hex: %s", formatAsHex ( buffer, len ) );
@@ -348,7 +348,7 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
 
     for ( ;; )
     {
-        id = MatchInfo::decode ( &_vpsSocket->_readBuffer[0], _vpsSocket->_readPos, consumed );
+        id = MatchInfo::decode ( _vpsSocket->getReadData(), _vpsSocket->getReadLength(), consumed );
 
         if ( id )
         {
@@ -360,7 +360,7 @@ void SmartSocket::socketRead ( Socket *socket, const char *buffer, size_t len, c
             continue;
         }
 
-        tun = TunInfo::decode ( &_vpsSocket->_readBuffer[0], _vpsSocket->_readPos, consumed );
+        tun = TunInfo::decode ( _vpsSocket->getReadData(), _vpsSocket->getReadLength(), consumed );
 
         if ( tun.matchId )
         {
@@ -607,3 +607,14 @@ bool SmartSocket::send ( const MsgPtr& message, const IpAddrPort& address )
 {
     BOILERPLATE_SEND ( message, address );
 }
+
+bool SmartSocket::sendEncoded ( const MsgPtr& message, const string& bytes )
+{
+    if ( ! isConnected() )
+        return false;
+    if ( _directSocket && _directSocket->isConnected() )
+        return _directSocket->sendEncoded ( message, bytes );
+    if ( _tunSocket && _tunSocket->isConnected() )
+        return _tunSocket->sendEncoded ( message, bytes );
+    return false;
+}
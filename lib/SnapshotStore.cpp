@@ -0,0 +1,359 @@
+#include "SnapshotStore.hpp"
+#include "Logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+// Compare two blocks a word at a time, blocks in the store and image are always word aligned
+static inline bool isBlockEqual ( const char *a, const char *b, size_t len )
+{
+    const uint32_t *wa = ( const uint32_t * ) a;
+    const uint32_t *wb = ( const uint32_t * ) b;
+    const size_t words = len / sizeof ( uint32_t );
+
+    size_t i = 0;
+
+    // Unrolled to compare 16 bytes per branch
+    for ( ; i + 4 <= words; i += 4 )
+    {
+        if ( ( wa[i] ^ wb[i] ) | ( wa[i + 1] ^ wb[i + 1] ) | ( wa[i + 2] ^ wb[i + 2] ) | ( wa[i + 3] ^ wb[i + 3] ) )
+            return false;
+    }
+
+    for ( ; i < words; ++i )
+    {
+        if ( wa[i] != wb[i] )
+            return false;
+    }
+
+    const size_t tail = words * sizeof ( uint32_t );
+    return ( memcmp ( a + tail, b + tail, len - tail ) == 0 );
+}
+
+
+// Encode the XOR of two blocks as runs of: 2 byte count of equal bytes, 2 byte count of XOR'd bytes, XOR'd bytes.
+// Runs of less than 4 equal bytes are kept inside the XOR'd bytes, since a new run header costs 4 bytes.
+// Returns the encoded length, or SIZE_MAX if the encoding would be longer than maxLen.
+static size_t encodeDelta ( const char *a, const char *b, size_t len, char *out, size_t maxLen )
+{
+    size_t i = 0, pos = 0;
+
+    while ( i < len )
+    {
+        const size_t start = i;
+
+        while ( i < len && a[i] == b[i] )
+            ++i;
+
+        const size_t equal = i - start;
+
+        if ( i == len )
+            break;
+
+        const size_t literalStart = i;
+
+        for ( size_t run = 0; i < len && run < 4; ++i )
+            run = ( a[i] == b[i] ? run + 1 : 0 );
+
+        // Don't include the trailing equal bytes
+        size_t literalEnd = i;
+        while ( literalEnd > literalStart && a[literalEnd - 1] == b[literalEnd - 1] )
+            --literalEnd;
+
+        i = literalEnd;
+
+        const uint16_t header[2] = { ( uint16_t ) equal, ( uint16_t ) ( literalEnd - literalStart ) };
+
+        if ( pos + sizeof ( header ) + header[1] > maxLen )
+            return SIZE_MAX;
+
+        memcpy ( out + pos, header, sizeof ( header ) );
+        pos += sizeof ( header );
+
+        for ( size_t j = literalStart; j < literalEnd; ++j )
+            out[pos++] = a[j] ^ b[j];
+    }
+
+    return pos;
+}
+
+// Apply an encoded delta to a block
+static void applyDelta ( const char *delta, size_t deltaLen, char *block )
+{
+    size_t pos = 0, i = 0;
+
+    while ( pos < deltaLen )
+    {
+        uint16_t header[2];
+        memcpy ( header, delta + pos, sizeof ( header ) );
+        pos += sizeof ( header );
+
+        i += header[0];
+
+        for ( size_t j = 0; j < header[1]; ++j )
+            block[i++] ^= delta[pos++];
+    }
+}
+
+
+void SnapshotStore::initialize ( size_t imageSize, size_t numSlots, size_t budgetBytes )
+{
+    ASSERT ( imageSize > 0 );
+
+    _imageSize = imageSize;
+    _numBlocks = ( imageSize + SNAPSHOT_BLOCK_SIZE - 1 ) / SNAPSHOT_BLOCK_SIZE;
+    _numPages = budgetBytes / SNAPSHOT_PAGE_SIZE;
+
+    // Need enough pages for at least one complete raw snapshot
+    if ( _numPages < _numBlocks * SNAPSHOT_PAGES_PER_BLOCK )
+        _numPages = _numBlocks * SNAPSHOT_PAGES_PER_BLOCK;
+
+    LOG ( "imageSize=%u; numSlots=%u; numBlocks=%u; numPages=%u", imageSize, numSlots, _numBlocks, _numPages );
+
+    _pages.resize ( _numPages * SNAPSHOT_PAGE_SIZE );
+    _records.resize ( _numPages );
+    _slotRecords.resize ( numSlots * _numBlocks );
+    _slotUsed.resize ( numSlots );
+    _referenceImage.resize ( _numBlocks * SNAPSHOT_BLOCK_SIZE );
+    _deltaBuffer.resize ( 2 * SNAPSHOT_BLOCK_SIZE );
+
+    clear();
+}
+
+void SnapshotStore::deinitialize()
+{
+    _imageSize = _numBlocks = _numPages = _lastDirtyBlocks = _sinceKeyframe = 0;
+    _referenceSlot = NoSlot;
+
+    // Swap with empty vectors to actually free the memory
+    vector<char>().swap ( _pages );
+    vector<uint32_t>().swap ( _freePages );
+    vector<Record>().swap ( _records );
+    vector<uint32_t>().swap ( _freeRecords );
+    vector<uint32_t>().swap ( _slotRecords );
+    vector<uint8_t>().swap ( _slotUsed );
+    vector<char>().swap ( _referenceImage );
+    vector<char>().swap ( _deltaBuffer );
+}
+
+void SnapshotStore::clear()
+{
+    _freePages.clear();
+    _freePages.reserve ( _numPages );
+    _freeRecords.clear();
+    _freeRecords.reserve ( _records.size() );
+
+    // Push in reverse so pages and records are allocated in ascending order
+    for ( size_t i = _numPages; i > 0; --i )
+        _freePages.push_back ( i - 1 );
+
+    for ( size_t i = _records.size(); i > 0; --i )
+        _freeRecords.push_back ( i - 1 );
+
+    fill ( _slotUsed.begin(), _slotUsed.end(), 0 );
+
+    _referenceSlot = NoSlot;
+    _sinceKeyframe = 0;
+    _lastDirtyBlocks = 0;
+}
+
+uint32_t SnapshotStore::allocateRecord ( const char *bytes, size_t len, uint32_t base )
+{
+    ASSERT ( len > 0 );
+    ASSERT ( len <= SNAPSHOT_BLOCK_SIZE );
+    ASSERT ( _freeRecords.empty() == false );
+
+    const uint32_t index = _freeRecords.back();
+    _freeRecords.pop_back();
+
+    Record& record = _records[index];
+    record.refCount = 1;
+    record.base = base;
+    record.length = len;
+    record.depth = ( base == NoRecord ? 0 : _records[base].depth + 1 );
+
+    if ( base != NoRecord )
+        ++_records[base].refCount;
+
+    for ( size_t i = 0; i < SNAPSHOT_PAGES_PER_BLOCK; ++i )
+    {
+        if ( i * SNAPSHOT_PAGE_SIZE >= len )
+        {
+            record.pages[i] = NoRecord;
+            continue;
+        }
+
+        ASSERT ( _freePages.empty() == false );
+
+        record.pages[i] = _freePages.back();
+        _freePages.pop_back();
+
+        memcpy ( &_pages[record.pages[i] * SNAPSHOT_PAGE_SIZE], bytes + i * SNAPSHOT_PAGE_SIZE,
+                 min<size_t> ( SNAPSHOT_PAGE_SIZE, len - i * SNAPSHOT_PAGE_SIZE ) );
+    }
+
+    return index;
+}
+
+void SnapshotStore::releaseRecord ( uint32_t index )
+{
+    while ( index != NoRecord )
+    {
+        Record& record = _records[index];
+
+        ASSERT ( record.refCount > 0 );
+
+        if ( --record.refCount > 0 )
+            return;
+
+        for ( size_t i = 0; i < SNAPSHOT_PAGES_PER_BLOCK && record.pages[i] != NoRecord; ++i )
+            _freePages.push_back ( record.pages[i] );
+
+        _freeRecords.push_back ( index );
+
+        // The base record was referenced by this delta
+        index = record.base;
+    }
+}
+
+void SnapshotStore::readRecord ( const Record& record, char *bytes ) const
+{
+    for ( size_t i = 0; i < SNAPSHOT_PAGES_PER_BLOCK && record.pages[i] != NoRecord; ++i )
+    {
+        memcpy ( bytes + i * SNAPSHOT_PAGE_SIZE, &_pages[record.pages[i] * SNAPSHOT_PAGE_SIZE],
+                 min<size_t> ( SNAPSHOT_PAGE_SIZE, record.length - i * SNAPSHOT_PAGE_SIZE ) );
+    }
+}
+
+void SnapshotStore::decodeRecord ( uint32_t index, char *block, size_t len )
+{
+    // Collect the delta chain, newest first
+    uint32_t chain[SNAPSHOT_KEYFRAME_INTERVAL];
+    size_t count = 0;
+
+    for ( ; _records[index].base != NoRecord; index = _records[index].base )
+    {
+        ASSERT ( count < SNAPSHOT_KEYFRAME_INTERVAL );
+        chain[count++] = index;
+    }
+
+    ASSERT ( _records[index].length == len );
+
+    readRecord ( _records[index], block );
+
+    // Apply the deltas from oldest to newest
+    while ( count > 0 )
+    {
+        const Record& record = _records[chain[--count]];
+        readRecord ( record, &_deltaBuffer[0] );
+        applyDelta ( &_deltaBuffer[0], record.length, block );
+    }
+}
+
+void SnapshotStore::save ( size_t slot, const char *image, size_t baseSlot )
+{
+    ASSERT ( slot < _slotUsed.size() );
+    ASSERT ( _slotUsed[slot] == 0 );
+    ASSERT ( canSave() == true );
+
+    const uint32_t *baseRecords = 0;
+
+    if ( baseSlot != NoSlot )
+    {
+        ASSERT ( baseSlot < _slotUsed.size() );
+        ASSERT ( _slotUsed[baseSlot] != 0 );
+
+        // Blocks are compared against the reference image, so it must contain the base snapshot
+        if ( baseSlot != _referenceSlot )
+            load ( baseSlot, &_referenceImage[0] );
+
+        baseRecords = &_slotRecords[baseSlot * _numBlocks];
+    }
+
+    const bool isKeyframe = ( ! baseRecords || ++_sinceKeyframe >= SNAPSHOT_KEYFRAME_INTERVAL );
+
+    if ( isKeyframe )
+        _sinceKeyframe = 0;
+
+    uint32_t *slotRecords = &_slotRecords[slot * _numBlocks];
+
+    _lastDirtyBlocks = 0;
+
+    for ( size_t i = 0; i < _numBlocks; ++i )
+    {
+        const char *src = image + i * SNAPSHOT_BLOCK_SIZE;
+        char *ref = &_referenceImage[i * SNAPSHOT_BLOCK_SIZE];
+        const size_t len = getBlockSize ( i );
+
+        if ( baseRecords && isBlockEqual ( src, ref, len ) )
+        {
+            // Share the base record if it is unchanged, keyframes can only share raw records
+            if ( ! isKeyframe || _records[baseRecords[i]].base == NoRecord )
+            {
+                slotRecords[i] = baseRecords[i];
+                ++_records[baseRecords[i]].refCount;
+                continue;
+            }
+
+            slotRecords[i] = allocateRecord ( src, len, NoRecord );
+            continue;
+        }
+
+        ++_lastDirtyBlocks;
+
+        // Only store a delta if it saves at least one page, and the delta chain isn't too long
+        const bool canDelta = ( ! isKeyframe && len > SNAPSHOT_PAGE_SIZE
+                                && _records[baseRecords[i]].depth + 1 < SNAPSHOT_KEYFRAME_INTERVAL );
+
+        const size_t deltaLen = ( canDelta ? encodeDelta ( src, ref, len, &_deltaBuffer[0], len - SNAPSHOT_PAGE_SIZE )
+                                  : SIZE_MAX );
+
+        if ( deltaLen != SIZE_MAX && deltaLen > 0 )
+            slotRecords[i] = allocateRecord ( &_deltaBuffer[0], deltaLen, baseRecords[i] );
+        else
+            slotRecords[i] = allocateRecord ( src, len, NoRecord );
+
+        memcpy ( ref, src, len );
+    }
+
+    _slotUsed[slot] = 1;
+    _referenceSlot = slot;
+}
+
+void SnapshotStore::load ( size_t slot, char *image )
+{
+    ASSERT ( slot < _slotUsed.size() );
+    ASSERT ( _slotUsed[slot] != 0 );
+
+    if ( slot != _referenceSlot )
+    {
+        const uint32_t *slotRecords = &_slotRecords[slot * _numBlocks];
+
+        for ( size_t i = 0; i < _numBlocks; ++i )
+            decodeRecord ( slotRecords[i], &_referenceImage[i * SNAPSHOT_BLOCK_SIZE], getBlockSize ( i ) );
+
+        _referenceSlot = slot;
+    }
+
+    if ( image != &_referenceImage[0] )
+        memcpy ( image, &_referenceImage[0], _imageSize );
+}
+
+void SnapshotStore::release ( size_t slot )
+{
+    ASSERT ( slot < _slotUsed.size() );
+    ASSERT ( _slotUsed[slot] != 0 );
+
+    const uint32_t *slotRecords = &_slotRecords[slot * _numBlocks];
+
+    for ( size_t i = 0; i < _numBlocks; ++i )
+        releaseRecord ( slotRecords[i] );
+
+    _slotUsed[slot] = 0;
+
+    if ( slot == _referenceSlot )
+        _referenceSlot = NoSlot;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+// Size of each block that a snapshot image is split into
+#define SNAPSHOT_BLOCK_SIZE ( 1024 )
+
+// Size of each page of storage, blocks are stored in one or more pages
+#define SNAPSHOT_PAGE_SIZE ( 256 )
+
+// Maximum number of pages per block
+#define SNAPSHOT_PAGES_PER_BLOCK ( SNAPSHOT_BLOCK_SIZE / SNAPSHOT_PAGE_SIZE )
+
+// Number of snapshots between keyframes, this bounds the length of the delta chain for any block
+#define SNAPSHOT_KEYFRAME_INTERVAL ( 8 )
+
+
+// Stores snapshots of a fixed size memory image, split into fixed size blocks.
+// Each snapshot is saved relative to a base snapshot, and blocks that are unchanged from the base are shared
+// instead of copied, so only the dirty blocks of each snapshot use new memory.
+// Dirty blocks are stored as an RLE compressed XOR delta against the same block in the base snapshot,
+// except every SNAPSHOT_KEYFRAME_INTERVAL snapshots, where every block is stored raw.
+// All storage is allocated up front from a fixed memory budget.
+// Snapshots are addressed by slot, which are managed by the caller.
+class SnapshotStore
+{
+public:
+
+    // Indicates no base snapshot
+    static const size_t NoSlot = SIZE_MAX;
+
+    // Allocate memory for the given number of slots, with a budget of budgetBytes for storing blocks
+    void initialize ( size_t imageSize, size_t numSlots, size_t budgetBytes );
+
+    // Free all memory
+    void deinitialize();
+
+    // Indicates the store has been initialized
+    bool isInitialized() const { return !_pages.empty(); }
+
+    // Release all slots, but keep the memory allocated
+    void clear();
+
+    // Size of the snapshot image
+    size_t getImageSize() const { return _imageSize; }
+
+    // Number of blocks in each snapshot image
+    size_t getNumBlocks() const { return _numBlocks; }
+
+    // Number of bytes of storage in use
+    size_t getUsedBytes() const { return ( _numPages - _freePages.size() ) * SNAPSHOT_PAGE_SIZE; }
+
+    // True if there is enough free storage to save a snapshot, even if every block is dirty and stored raw
+    bool canSave() const
+    {
+        return ( _freePages.size() >= _numBlocks * SNAPSHOT_PAGES_PER_BLOCK && _freeRecords.size() >= _numBlocks );
+    }
+
+    // Save the image to the given slot, sharing unchanged blocks with the snapshot in baseSlot.
+    // The slot must not be in use, and canSave() must be true.
+    void save ( size_t slot, const char *image, size_t baseSlot );
+
+    // Load the image saved in the given slot
+    void load ( size_t slot, char *image );
+
+    // Release the blocks used by the given slot
+    void release ( size_t slot );
+
+    // Number of dirty blocks in the last saved snapshot
+    size_t getLastDirtyBlocks() const { return _lastDirtyBlocks; }
+
+private:
+
+    // A stored block, shared by every slot where the block is unchanged
+    struct Record
+    {
+        // Number of slots and delta records referencing this record
+        uint32_t refCount;
+
+        // The record this is a delta against, or NoRecord if this is a raw block
+        uint32_t base;
+
+        // Number of bytes stored
+        uint16_t length;
+
+        // Length of the delta chain ending at this record, 0 for a raw block
+        uint16_t depth;
+
+        // Pages storing the data
+        uint32_t pages[SNAPSHOT_PAGES_PER_BLOCK];
+    };
+
+    // Indicates no record
+    static const uint32_t NoRecord = UINT32_MAX;
+
+    // Size of the snapshot image
+    size_t _imageSize = 0;
+
+    // Number of blocks per image
+    size_t _numBlocks = 0;
+
+    // Total number of pages
+    size_t _numPages = 0;
+
+    // Storage for all pages
+    std::vector<char> _pages;
+
+    // Unused pages
+    std::vector<uint32_t> _freePages;
+
+    // All records, there can't be more records than pages
+    std::vector<Record> _records;
+
+    // Unused records
+    std::vector<uint32_t> _freeRecords;
+
+    // Mapping: slot -> image block -> record
+    std::vector<uint32_t> _slotRecords;
+
+    // Flag for each slot in use
+    std::vector<uint8_t> _slotUsed;
+
+    // Copy of the image in the reference slot, the most recently saved or loaded snapshot
+    std::vector<char> _referenceImage;
+    size_t _referenceSlot = NoSlot;
+
+    // Number of snapshots saved since the last keyframe
+    size_t _sinceKeyframe = 0;
+
+    // Number of dirty blocks in the last saved snapshot
+    size_t _lastDirtyBlocks = 0;
+
+    // Temporary buffer for encoding and decoding deltas
+    std::vector<char> _deltaBuffer;
+
+    // Size of the given image block, only the last block can be smaller than SNAPSHOT_BLOCK_SIZE
+    size_t getBlockSize ( size_t block ) const
+    {
+        return ( block + 1 < _numBlocks ? SNAPSHOT_BLOCK_SIZE : _imageSize - block * SNAPSHOT_BLOCK_SIZE );
+    }
+
+    // Allocate a record holding a copy of the given bytes, and optionally a reference to a base record
+    uint32_t allocateRecord ( const char *bytes, size_t len, uint32_t base );
+
+    // Decrement the reference count of a record, freeing it and its base chain when unused
+    void releaseRecord ( uint32_t record );
+
+    // Copy the bytes stored in a record
+    void readRecord ( const Record& record, char *bytes ) const;
+
+    // Decode a block from a record, following the delta chain back to a raw block
+    void decodeRecord ( uint32_t record, char *block, size_t len );
+};
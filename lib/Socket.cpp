@@ -14,12 +14,16 @@
 
 #include <unordered_set>
 #include <algorithm>
+#include <cstring>
 
 using namespace std;
 
 
 #define READ_BUFFER_SIZE ( 1024 * 4096 )
 
+// Minimum free space at the end of the read buffer before a read, larger than any UDP datagram
+#define READ_BUFFER_MIN_FREE ( 64 * 1024 )
+
 #define SET_NON_BLOCKING_MODE(VALUE)                                                                                \
     do {                                                                                                            \
         u_long flag = VALUE;                                                                                        \
@@ -347,14 +351,14 @@ void Socket::resetBuffer()
 {
     _readBuffer.reserve ( READ_BUFFER_SIZE );
     _readBuffer.resize ( READ_BUFFER_SIZE, ( char ) 0 );
-    _readPos = 0;
+    _readStart = _readPos = 0;
 }
 
 void Socket::freeBuffer()
 {
     _readBuffer.clear();
     _readBuffer.shrink_to_fit();
-    _readPos = 0;
+    _readStart = _readPos = 0;
 }
 
 void Socket::consumeBuffer ( size_t bytes )
@@ -362,16 +366,36 @@ void Socket::consumeBuffer ( size_t bytes )
     if ( bytes == 0 )
         return;
 
-    // Erase the consumed bytes (shifting the array)
-    ASSERT ( bytes <= _readPos );
-    _readBuffer.erase ( 0, bytes );
-    _readBuffer.reserve ( READ_BUFFER_SIZE );
-    _readBuffer.resize ( READ_BUFFER_SIZE, ( char ) 0 );
-    _readPos -= bytes;
+    ASSERT ( _readStart + bytes <= _readPos );
+    _readStart += bytes;
+
+    // Rewind for free once everything has been consumed, which is the common case
+    if ( _readStart == _readPos )
+        _readStart = _readPos = 0;
+}
+
+void Socket::reserveBuffer()
+{
+    if ( _readBuffer.size() >= _readPos + READ_BUFFER_MIN_FREE )
+        return;
+
+    // Shift the unread bytes to the front of the buffer
+    if ( _readStart > 0 )
+    {
+        memmove ( &_readBuffer[0], &_readBuffer[_readStart], _readPos - _readStart );
+        _readPos -= _readStart;
+        _readStart = 0;
+    }
+
+    // Only grow if a partial message is taking up most of the buffer
+    if ( _readBuffer.size() < _readPos + READ_BUFFER_MIN_FREE )
+        _readBuffer.resize ( max<size_t> ( READ_BUFFER_SIZE, 2 * _readBuffer.size() ), ( char ) 0 );
 }
 
 void Socket::socketRead()
 {
+    reserveBuffer();
+
     ASSERT ( _readPos < _readBuffer.size() );
 
     char *bufferStart = &_readBuffer[_readPos];
@@ -430,7 +454,7 @@ void Socket::socketRead()
 
     // Increment the buffer position
     _readPos += bufferLen;
-    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", bufferLen, address, _readPos );
+    LOG ( "Read [ %u bytes ] from '%s'; %u bytes remaining in buffer", bufferLen, address, getReadLength() );
 
     // Handle zero byte packets
     if ( bufferLen == 0 )
@@ -444,7 +468,7 @@ void Socket::socketRead()
         LOG ( "Hex: %s", formatAsHex ( bufferStart, bufferLen ) );
 
     // Check if the first byte is a valid message type
-    if ( _readPos >= sizeof ( MsgType ) && ! ::Protocol::checkMsgType ( * ( MsgType * ) &_readBuffer[0] ) )
+    if ( getReadLength() >= sizeof ( MsgType ) && ! ::Protocol::checkMsgType ( * ( MsgType * ) getReadData() ) )
     {
         LOG ( "Clearing invalid buffer!" );
         resetBuffer();
@@ -455,14 +479,15 @@ void Socket::socketRead()
     for ( ;; )
     {
         size_t consumedBytes = 0;
-        MsgPtr msg = ::Protocol::decode ( &_readBuffer[0], _readPos, consumedBytes );
+        MsgPtr msg = ::Protocol::decode ( getReadData(), getReadLength(), consumedBytes );
         consumeBuffer ( consumedBytes );
 
         // Abort if a message could not be decoded
         if ( ! msg.get() )
             return;
 
-        LOG ( "Decoded '%s' using [ %u bytes ]; %u bytes remaining in buffer", msg, consumedBytes, _readPos );
+        LOG ( "Decoded '%s' using [ %u bytes ]; %u bytes remaining in buffer",
+              msg, consumedBytes, getReadLength() );
         socketRead ( msg, address );
 
         // Abort if the socket is de-allocated
@@ -499,7 +524,9 @@ MsgPtr Socket::share ( int processId )
     LOG ( "Sharing:" );
     LOG ( "address='%s'; protocol=%s; state=%s", address, protocol, _state );
 
-    return MsgPtr ( new SocketShareData ( address, protocol, _readBuffer, _readPos, _state, info ) );
+    // Only the unread bytes need to be shared
+    return MsgPtr ( new SocketShareData ( address, protocol, string ( getReadData(), getReadLength() ),
+                                          getReadLength(), _state, info ) );
 }
 
 SocketShareData::SocketShareData ( const IpAddrPort& address,
@@ -110,6 +110,10 @@ public:
         return send ( MsgPtr ( const_cast<Serializable *> ( &message ), ignoreMsgPtr ), address );
     }
 
+    // Send a protocol message that has already been encoded, so the same bytes can be sent to many sockets.
+    // By default the message is encoded again, since not every socket sends the same bytes, ie UDP sequences.
+    virtual bool sendEncoded ( const MsgPtr& message, const std::string& bytes ) { return send ( message ); }
+
     // Set the packet loss for testing purposes
     void setPacketLoss ( uint8_t percentage );
 
@@ -135,9 +139,14 @@ public:
 
 protected:
 
-    // Socket read buffer
+    // Socket read buffer, unread data is the range [_readStart, _readPos).
+    // Consuming only advances _readStart, unread bytes are shifted to the front only when the free space
+    // at the end runs low, and the buffer only grows if a single partial message doesn't fit.
     std::string _readBuffer;
 
+    // The position of the first unread byte
+    size_t _readStart = 0;
+
     // The position for the next read event.
     // In raw mode, this should be manually updated, otherwise each read will at the same position.
     // In message mode, this is automatically managed, and is only reset when a decode fails.
@@ -170,6 +179,13 @@ protected:
     // Consume bytes from the front of the buffer
     void consumeBuffer ( size_t bytes );
 
+    // Make sure there is enough free space at the end of the buffer for the next read
+    void reserveBuffer();
+
+    // Get the unread data in the buffer
+    char *getReadData() { return &_readBuffer[_readStart]; }
+    size_t getReadLength() const { return _readPos - _readStart; }
+
     // TCP event callbacks
     virtual void socketAccepted() {}
     virtual void socketConnected() {}
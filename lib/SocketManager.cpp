@@ -41,8 +41,14 @@ void SocketManager::check ( uint64_t timeout )
         _changed = false;
     }
 
+    ASSERT ( timeout > 0 );
+
+    // Nothing to select on, but still wait for the timeout so the event loop doesn't spin
     if ( _activeSockets.empty() )
+    {
+        Sleep ( timeout );
         return;
+    }
 
     fd_set readFds, writeFds;
     FD_ZERO ( &readFds );
@@ -56,8 +62,6 @@ void SocketManager::check ( uint64_t timeout )
             FD_SET ( socket->_fd, &readFds );
     }
 
-    ASSERT ( timeout > 0 );
-
     timeval tv;
     tv.tv_sec = timeout / 1000UL;
     tv.tv_usec = ( timeout * 1000UL ) % 1000000UL;
@@ -29,6 +29,9 @@ public:
         return ( _allocatedSockets.find ( socket ) != _allocatedSockets.end() );
     }
 
+    // Indicates if there are no allocated sockets
+    bool isEmpty() const { return _allocatedSockets.empty(); }
+
     // Get the singleton instance
     static SocketManager& get();
 
@@ -138,6 +138,16 @@ bool TcpSocket::send ( const MsgPtr& msg, const IpAddrPort& address )
     return Socket::send ( &buffer[0], buffer.size() );
 }
 
+bool TcpSocket::sendEncoded ( const MsgPtr& msg, const string& bytes )
+{
+    if ( bytes.empty() )
+        return send ( msg );
+
+    LOG ( "Sending encoded '%s' [ %u bytes ]", msg, bytes.size() );
+
+    return Socket::send ( &bytes[0], bytes.size() );
+}
+
 SocketPtr TcpSocket::shared ( Socket::Owner *owner, const SocketShareData& data )
 {
     if ( data.protocol != Protocol::TCP )
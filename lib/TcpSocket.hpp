@@ -33,6 +33,7 @@ public:
     bool send ( SerializableMessage *message, const IpAddrPort& address = NullAddress ) override;
     bool send ( SerializableSequence *message, const IpAddrPort& address = NullAddress ) override;
     bool send ( const MsgPtr& message, const IpAddrPort& address = NullAddress ) override;
+    bool sendEncoded ( const MsgPtr& message, const std::string& bytes ) override;
 
 protected:
 
@@ -435,6 +435,113 @@ void UdpSocket::goBackNTimeout ( GoBackN *gbn )
         owner->socketDisconnected ( this );
 }
 
+bool UdpSocket::readBatch()
+{
+    if ( _batchBuffer.empty() )
+    {
+        _batchBuffer.resize ( UDP_BATCH_BUFFER_SIZE );
+        _batchDatagrams.reserve ( UDP_BATCH_MAX_DATAGRAMS );
+    }
+
+    _batchDatagrams.clear();
+
+    size_t offset = 0;
+
+    // Winsock has no recvmmsg, so drain the socket with non-blocking recvfrom calls instead
+    while ( _batchDatagrams.size() < UDP_BATCH_MAX_DATAGRAMS
+            && offset + UDP_MAX_DATAGRAM_SIZE <= _batchBuffer.size() )
+    {
+        size_t len = UDP_MAX_DATAGRAM_SIZE;
+        IpAddrPort address;
+
+        const int error = Socket::recvfrom ( &_batchBuffer[offset], len, address );
+
+        if ( error )
+        {
+            // No more pending datagrams
+            if ( error == WSAEWOULDBLOCK )
+                break;
+
+            // WSAECONNRESET does not mean the UDP socket is dead, see comment in Socket::socketRead
+            if ( error == WSAECONNRESET )
+                continue;
+
+            LOG_UDP_SOCKET ( this, "[%d] %s; recvfrom failed", error, WinException::getAsString ( error ) );
+            LOG_UDP_SOCKET ( this, "disconnect due to read error" );
+            disconnect();
+            return false;
+        }
+
+#ifndef RELEASE
+        // Simulated packet loss
+        if ( rand() % 100 < _packetLoss )
+        {
+            LOG ( "Discarding [ %u bytes ] from '%s'", len, address );
+            continue;
+        }
+#endif
+
+        _batchDatagrams.push_back ( { offset, len, address } );
+        offset += len;
+    }
+
+    return true;
+}
+
+void UdpSocket::socketRead()
+{
+    // Only message-based server sockets are batched, since they multiplex many child sockets on one fd
+    if ( _isRaw || _type != Type::Server )
+    {
+        Socket::socketRead();
+        return;
+    }
+
+    if ( ! readBatch() )
+        return;
+
+    LOG_UDP_SOCKET ( this, "Read %u datagrams", _batchDatagrams.size() );
+
+    for ( const BatchDatagram& datagram : _batchDatagrams )
+    {
+        const char *bytes = &_batchBuffer[datagram.offset];
+        size_t remaining = datagram.len;
+
+        // Handle zero byte packets
+        if ( remaining == 0 )
+            socketReadAddressed ( NullMsg, datagram.address );
+
+        // Each datagram is self-contained, so decode directly out of the batch buffer
+        while ( remaining > 0 )
+        {
+            if ( ! ::Protocol::checkMsgType ( * ( MsgType * ) bytes ) )
+            {
+                LOG ( "Ignoring invalid datagram from '%s'", datagram.address );
+                break;
+            }
+
+            size_t consumedBytes = 0;
+            MsgPtr msg = ::Protocol::decode ( bytes, remaining, consumedBytes );
+
+            if ( ! msg.get() )
+                break;
+
+            bytes += consumedBytes;
+            remaining -= consumedBytes;
+
+            LOG ( "Decoded '%s' using [ %u bytes ] from '%s'", msg, consumedBytes, datagram.address );
+            socketReadAddressed ( msg, datagram.address );
+
+            // Abort if the socket is de-allocated or disconnected
+            if ( ! SocketManager::get().isAllocated ( this ) || isDisconnected() )
+                return;
+        }
+
+        if ( ! SocketManager::get().isAllocated ( this ) || isDisconnected() )
+            return;
+    }
+}
+
 void UdpSocket::socketRead ( const MsgPtr& msg, const IpAddrPort& address )
 {
     if ( isConnectionLess() )
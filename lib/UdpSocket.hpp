@@ -6,6 +6,15 @@
 
 #define DEFAULT_KEEP_ALIVE_TIMEOUT ( 20000 )
 
+// Maximum number of datagrams drained per read event on server sockets
+#define UDP_BATCH_MAX_DATAGRAMS ( 64 )
+
+// Size of the reusable buffer that batched datagrams are packed into
+#define UDP_BATCH_BUFFER_SIZE ( 256 * 1024 )
+
+// Space reserved for each datagram in the batch buffer, larger than any UDP payload
+#define UDP_MAX_DATAGRAM_SIZE ( 64 * 1024 )
+
 
 struct UdpControl : public SerializableSequence
 {
@@ -117,9 +126,26 @@ private:
     // Currently accepted socket
     SocketPtr _acceptedSocket;
 
+    // Received datagram in the batch buffer
+    struct BatchDatagram
+    {
+        size_t offset, len;
+        IpAddrPort address;
+    };
+
+    // Reusable buffer and datagram list for batched reads, only allocated for server sockets
+    std::vector<char> _batchBuffer;
+    std::vector<BatchDatagram> _batchDatagrams;
+
+    // Socket read event callback, server sockets drain all pending datagrams before dispatching
+    void socketRead() override;
+
     // Socket read event callback
     void socketRead ( const MsgPtr& msg, const IpAddrPort& address ) override;
 
+    // Read all pending datagrams into the batch buffer, returns false if the socket was disconnected
+    bool readBatch();
+
     // GoBackN callbacks
     void goBackNSendRaw ( GoBackN *gbn, const MsgPtr& msg ) override;
     void goBackNRecvRaw ( GoBackN *gbn, const MsgPtr& msg ) override;
@@ -10,6 +10,7 @@ using namespace std;
 static vector<Version> breakingVersions =
 {
     "2.1e", // Changed protocol by adding UdpControl::Disconnect
+    "3.0.024", // Changed protocol by adding the acked frame, state hash, and frame advantage to PlayerInputs
 };
 
 
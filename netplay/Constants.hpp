@@ -6,9 +6,12 @@
 #include "Controller.hpp"
 
 
-// Number of frames of inputs to send per message
+// Maximum number of frames of inputs to send per message
 #define NUM_INPUTS                  ( 30 )
 
+// Minimum number of frames of inputs to send per message, even if the remote side already has them
+#define MIN_REDUNDANT_INPUTS        ( 4 )
+
 // Max allow rollback frames
 #define MAX_ROLLBACK                ( 15 )
 
@@ -0,0 +1,123 @@
+#include "DelayTuner.hpp"
+#include "Algorithms.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+
+// Get the smallest bucket that the given fraction of samples are at or below
+template<size_t N>
+static uint32_t getPercentile ( const array<uint32_t, N>& buckets, uint32_t total, double fraction )
+{
+    uint32_t count = 0;
+
+    for ( size_t i = 0; i < buckets.size(); ++i )
+    {
+        count += buckets[i];
+
+        if ( count >= fraction * total )
+            return i;
+    }
+
+    return buckets.size() - 1;
+}
+
+
+void DelayTuner::addLatency ( double latency )
+{
+    latency = max ( 0.0, latency );
+
+    ++_latencies [ min<size_t> ( ceil ( latency ), _latencies.size() - 1 ) ];
+    ++_numLatencies;
+
+    _latencySum += latency;
+    _latencySquaredSum += latency * latency;
+}
+
+void DelayTuner::addFrame ( bool waitedOnInputs )
+{
+    ++_numFrames;
+
+    if ( waitedOnInputs )
+        ++_numWaitedFrames;
+}
+
+void DelayTuner::addRollback ( uint32_t depth )
+{
+    ++_depths [ min<uint32_t> ( depth, _depths.size() - 1 ) ];
+    ++_numRollbacks;
+}
+
+bool DelayTuner::recommend ( uint8_t delay, uint8_t rollback, uint8_t& newDelay, uint8_t& newRollback ) const
+{
+    if ( _numLatencies < MIN_TUNER_SAMPLES )
+        return false;
+
+    // Latency that only the wait budget of frames may exceed, this has to be covered by the delay and rollback
+    uint32_t total = getPercentile ( _latencies, _numLatencies, 1.0 - TARGET_WAIT_RATE );
+
+    // Waited more often than the budget even though the latency was covered, ie the inputs arrived in bursts
+    if ( _numWaitedFrames > TARGET_WAIT_RATE * _numFrames && total <= uint32_t ( delay + rollback ) )
+        total = delay + rollback + 1;
+
+    // Latency that the rollback depth budget applies to
+    uint32_t depthLatency = getPercentile ( _latencies, _numLatencies, TARGET_ROLLBACK_PERCENTILE );
+
+    // The measured rollback depths are reduced by the current delay
+    if ( _numRollbacks )
+    {
+        depthLatency = max ( depthLatency,
+                             delay + getPercentile ( _depths, _numRollbacks, TARGET_ROLLBACK_PERCENTILE ) );
+    }
+
+    // Any latency that can't be covered by the maximum rollback must be covered by the delay
+    const uint32_t minDelay = ( total > MAX_ROLLBACK ? total - MAX_ROLLBACK : 0 );
+
+    uint32_t d = ( depthLatency > TARGET_ROLLBACK_DEPTH ? depthLatency - TARGET_ROLLBACK_DEPTH : 0 );
+    d = min<uint32_t> ( max ( d, minDelay ), MAX_TUNER_DELAY );
+
+    // Keep the current delay if it's only slightly higher than needed
+    if ( d < delay && d + TUNER_HYSTERESIS > delay )
+        d = delay;
+
+    uint32_t r = clamped<uint32_t> ( total > d ? total - d : 0, 1, MAX_ROLLBACK );
+
+    // Same for the rollback
+    if ( r < rollback && r + TUNER_HYSTERESIS > rollback )
+        r = rollback;
+
+    newDelay = d;
+    newRollback = r;
+
+    return ( newDelay != delay || newRollback != rollback );
+}
+
+double DelayTuner::getMeanLatency() const
+{
+    if ( _numLatencies == 0 )
+        return 0;
+
+    return _latencySum / _numLatencies;
+}
+
+double DelayTuner::getJitter() const
+{
+    if ( _numLatencies < 2 )
+        return 0;
+
+    const double mean = getMeanLatency();
+
+    return sqrt ( max ( 0.0, _latencySquaredSum / _numLatencies - mean * mean ) );
+}
+
+void DelayTuner::clear()
+{
+    _latencies.fill ( 0 );
+    _numLatencies = 0;
+    _latencySum = _latencySquaredSum = 0;
+    _numFrames = _numWaitedFrames = 0;
+    _depths.fill ( 0 );
+    _numRollbacks = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Constants.hpp"
+
+#include <array>
+
+
+// Fraction of frames that may wait on remote inputs
+#define TARGET_WAIT_RATE ( 0.01 )
+
+// Rollback depth that the given fraction of rollbacks should be within
+#define TARGET_ROLLBACK_DEPTH ( 4 )
+#define TARGET_ROLLBACK_PERCENTILE ( 0.95 )
+
+// Maximum delay that is recommended, same as the hotkeys
+#define MAX_TUNER_DELAY ( 9 )
+
+// Minimum number of latency samples before making a recommendation
+#define MIN_TUNER_SAMPLES ( 300 )
+
+// The delay and rollback are only lowered by at least this many frames, so they don't flip every round
+#define TUNER_HYSTERESIS ( 2 )
+
+
+// Recommends the delay and rollback from the input latency and rollback telemetry measured during rollback.
+// Each side's delay hides the latency of its own inputs for the other side, so both sides are assumed to run with
+// similar settings, which is the case when both sides use the recommendations.
+class DelayTuner
+{
+public:
+
+    // Record the one-way input latency in frames for the current frame
+    void addLatency ( double latency );
+
+    // Record a frame, and whether it had to wait for remote inputs
+    void addFrame ( bool waitedOnInputs );
+
+    // Record a rollback to the given depth
+    void addRollback ( uint32_t depth );
+
+    // Get the recommended delay and rollback, given the current delay and rollback.
+    // Returns false if there aren't enough samples, or the current settings are already within the targets.
+    bool recommend ( uint8_t delay, uint8_t rollback, uint8_t& newDelay, uint8_t& newRollback ) const;
+
+    // Get the mean and standard deviation of the input latency in frames
+    double getMeanLatency() const;
+    double getJitter() const;
+
+    // Clear the samples, after each recommendation, so the next one is based on recent samples only
+    void clear();
+
+private:
+
+    // Histogram of latencies rounded up to the frame, the last bucket counts every higher latency
+    std::array<uint32_t, 64> _latencies = {{}};
+
+    uint32_t _numLatencies = 0;
+
+    double _latencySum = 0, _latencySquaredSum = 0;
+
+    // Number of frames, and the frames that waited on remote inputs
+    uint32_t _numFrames = 0, _numWaitedFrames = 0;
+
+    // Histogram of rollback depths, the last bucket counts every deeper rollback
+    std::array<uint32_t, MAX_ROLLBACK + 2> _depths = {{}};
+
+    uint32_t _numRollbacks = 0;
+};
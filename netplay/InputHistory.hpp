@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+
+// Number of frames kept in the history, must be a multiple of 64
+#define INPUT_HISTORY_SIZE ( 1024 )
+
+// Number of channels, one per direction value, and one per button
+#define INPUT_HISTORY_CHANNELS ( 32 )
+
+
+// History of the inputs of a single player, stored as one ring bitset of frames per channel,
+// so checking if any or every frame in a range has an input is a few mask operations per 64 frames.
+// Only the newest INPUT_HISTORY_SIZE contiguous frames are kept, queries are limited to those frames.
+class InputHistory
+{
+public:
+
+    // Get the channel of a direction value, ie 2 is down, 8 is up
+    static uint32_t getDirectionChannel ( uint16_t direction ) { return ( 1u << ( direction & 0xF ) ); }
+
+    // Get the channels of the given buttons, same bits as the buttons of an input
+    static uint32_t getButtonChannels ( uint16_t buttons ) { return ( uint32_t ( buttons & 0xFFF ) << 16 ); }
+
+    // Get the channels of an input
+    static uint32_t getChannels ( uint16_t input )
+    {
+        return getDirectionChannel ( input & 0xF ) | getButtonChannels ( input >> 4 );
+    }
+
+    // Set the input for the given frame. Frames can be changed or appended, any other frame restarts the history.
+    void set ( uint32_t frame, uint16_t input )
+    {
+        if ( frame < _beginFrame || frame > _endFrame )
+            _beginFrame = _endFrame = frame;
+
+        if ( frame == _endFrame )
+        {
+            ++_endFrame;
+
+            if ( _endFrame - _beginFrame > INPUT_HISTORY_SIZE )
+                ++_beginFrame;
+        }
+
+        const uint32_t channels = getChannels ( input );
+        const size_t word = ( frame % INPUT_HISTORY_SIZE ) / 64;
+        const uint64_t bit = 1llu << ( frame % 64 );
+
+        for ( size_t i = 0; i < INPUT_HISTORY_CHANNELS; ++i )
+        {
+            if ( ( channels >> i ) & 1 )
+                _bits[i][word] |= bit;
+            else
+                _bits[i][word] &= ~bit;
+        }
+    }
+
+    // Forget the inputs starting from the given frame, so they can be set again
+    void invalidate ( uint32_t frame )
+    {
+        _endFrame = std::max ( _beginFrame, std::min ( _endFrame, frame ) );
+    }
+
+    // Forget all inputs
+    void clear()
+    {
+        _beginFrame = _endFrame = 0;
+    }
+
+    // Get the range of frames in the history
+    uint32_t getBeginFrame() const { return _beginFrame; }
+    uint32_t getEndFrame() const { return _endFrame; }
+
+    // Get the channels of the given frame, 0 if not in the history
+    uint32_t getFrameChannels ( uint32_t frame ) const
+    {
+        if ( frame < _beginFrame || frame >= _endFrame )
+            return 0;
+
+        const size_t word = ( frame % INPUT_HISTORY_SIZE ) / 64;
+        uint32_t channels = 0;
+
+        for ( size_t i = 0; i < INPUT_HISTORY_CHANNELS; ++i )
+        {
+            if ( ( _bits[i][word] >> ( frame % 64 ) ) & 1 )
+                channels |= ( 1u << i );
+        }
+
+        return channels;
+    }
+
+    // Count the frames in [first, end) that have any of the given channels, only frames in the history are counted
+    uint32_t count ( uint32_t channels, uint32_t first, uint32_t end ) const
+    {
+        first = std::max ( first, _beginFrame );
+        end = std::min ( end, _endFrame );
+
+        uint32_t count = 0;
+
+        for ( uint32_t frame = first; frame < end; )
+        {
+            const size_t word = ( frame % INPUT_HISTORY_SIZE ) / 64;
+            const uint32_t offset = frame % 64;
+            const uint32_t len = std::min ( 64 - offset, end - frame );
+            const uint64_t mask = ( len == 64 ? ~0llu : ( ( 1llu << len ) - 1 ) << offset );
+
+            uint64_t bits = 0;
+
+            for ( uint32_t c = channels; c; c &= c - 1 )
+                bits |= _bits[__builtin_ctz ( c )][word];
+
+            count += __builtin_popcountll ( bits & mask );
+            frame += len;
+        }
+
+        return count;
+    }
+
+    // Check if any frame in [first, end) has any of the given channels
+    bool any ( uint32_t channels, uint32_t first, uint32_t end ) const
+    {
+        return count ( channels, first, end ) > 0;
+    }
+
+    // Check if every frame in [first, end) has any of the given channels, false if not all the frames are known
+    bool all ( uint32_t channels, uint32_t first, uint32_t end ) const
+    {
+        if ( first < _beginFrame || end > _endFrame )
+            return false;
+
+        return count ( channels, first, end ) == end - first;
+    }
+
+private:
+
+    // Mapping: channel -> frame % INPUT_HISTORY_SIZE -> bit
+    std::array<std::array<uint64_t, INPUT_HISTORY_SIZE / 64>, INPUT_HISTORY_CHANNELS> _bits = {{}};
+
+    // Range of frames in the history
+    uint32_t _beginFrame = 0, _endFrame = 0;
+};
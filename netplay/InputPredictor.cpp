@@ -0,0 +1,51 @@
+#include "InputPredictor.hpp"
+
+using namespace std;
+
+
+// Maximum number of frames to follow the most frequent inputs, after that the prediction is held
+#define MAX_PREDICTION_STEPS ( 8 )
+
+
+shared_ptr<InputPredictor> InputPredictor::create ( InputPrediction type )
+{
+    switch ( type.value )
+    {
+        case InputPrediction::ReleaseButtons:
+            return make_shared<ReleaseButtonsPredictor>();
+
+        case InputPrediction::Frequency:
+            return make_shared<FrequencyPredictor>();
+
+        default:
+            return make_shared<HoldLastPredictor>();
+    }
+}
+
+void FrequencyPredictor::update ( uint16_t prev, uint16_t input )
+{
+    const uint32_t count = ++_counts[ ( uint32_t ( prev ) << 16 ) | input ];
+
+    pair<uint16_t, uint32_t>& mostFrequent = _mostFrequent[prev];
+
+    if ( count > mostFrequent.second )
+        mostFrequent = make_pair ( input, count );
+}
+
+uint16_t FrequencyPredictor::predict ( uint16_t last, uint32_t ahead ) const
+{
+    uint16_t input = last;
+
+    for ( uint32_t i = 0; i < ahead && i < MAX_PREDICTION_STEPS; ++i )
+    {
+        const auto it = _mostFrequent.find ( input );
+
+        // Hold the input if nothing has been learned, or if the input is most likely to be held
+        if ( it == _mostFrequent.end() || it->second.first == input )
+            break;
+
+        input = it->second.first;
+    }
+
+    return input;
+}
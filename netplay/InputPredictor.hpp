@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Enum.hpp"
+
+#include <memory>
+#include <unordered_map>
+
+
+// HoldLast: Repeat the last known input
+// ReleaseButtons: Keep the direction of the last known input, but release all the buttons
+// Frequency: The most frequent input following the last known input, learned from the player's inputs
+ENUM ( InputPrediction, HoldLast, ReleaseButtons, Frequency );
+
+
+// Predicts the inputs of a player that haven't been received yet
+class InputPredictor
+{
+public:
+
+    virtual ~InputPredictor() {}
+
+    // Learn from an actual input of the player, and the input on the frame before it
+    virtual void update ( uint16_t prev, uint16_t input ) {}
+
+    // Predict the input the given number of frames ( >= 1 ) after the last known input
+    virtual uint16_t predict ( uint16_t last, uint32_t ahead ) const = 0;
+
+    // Create a predictor of the given type, defaults to HoldLast
+    static std::shared_ptr<InputPredictor> create ( InputPrediction type );
+};
+
+
+class HoldLastPredictor : public InputPredictor
+{
+public:
+
+    uint16_t predict ( uint16_t last, uint32_t ahead ) const override { return last; }
+};
+
+
+class ReleaseButtonsPredictor : public InputPredictor
+{
+public:
+
+    uint16_t predict ( uint16_t last, uint32_t ahead ) const override { return ( last & 0xF ); }
+};
+
+
+class FrequencyPredictor : public InputPredictor
+{
+public:
+
+    void update ( uint16_t prev, uint16_t input ) override;
+
+    uint16_t predict ( uint16_t last, uint32_t ahead ) const override;
+
+private:
+
+    // Mapping: ( prev << 16 | input ) -> number of times input followed prev
+    std::unordered_map<uint32_t, uint32_t> _counts;
+
+    // Mapping: prev -> most frequent input following prev, and its count
+    std::unordered_map<uint16_t, std::pair<uint16_t, uint32_t>> _mostFrequent;
+};
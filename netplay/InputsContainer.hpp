@@ -3,8 +3,24 @@
 #include "Constants.hpp"
 #include "Logger.hpp"
 
+#include <deque>
 #include <vector>
+#include <array>
+#include <memory>
 #include <algorithm>
+#include <cstring>
+
+#if defined ( __GNUC__ ) && ( defined ( __i386__ ) || defined ( __x86_64__ ) )
+#define INPUTS_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// Number of frames of inputs per page, pages are allocated as needed so existing inputs never move
+#define INPUTS_PAGE_SIZE ( 256 )
+
+// Maximum number of pages of erased indices that are kept for reuse
+#define MAX_FREE_INPUTS_PAGES ( 64 )
 
 
 template<typename T>
@@ -13,13 +29,19 @@ class InputsContainer
 public:
 
     // Get a single input for the given index:frame, returns 0 if none.
+    // After the last known input, returns the predicted input if any, otherwise the last known input.
     T get ( uint32_t index, uint32_t frame ) const
     {
         if ( index >= _inputs.size() || _inputs[index].empty() )
             return lastInputBefore ( index );
 
-        if ( frame >= _inputs[index].size() )
+        if ( frame >= _inputs[index].size )
+        {
+            if ( index + 1 == _inputs.size() && frame - _inputs[index].size < _predicted.size() )
+                return _predicted[frame - _inputs[index].size];
+
             return _inputs[index].back();
+        }
 
         return _inputs[index][frame];
     }
@@ -28,16 +50,18 @@ public:
     void get ( uint32_t index, uint32_t frame, T *t, size_t n ) const
     {
         ASSERT ( index < _inputs.size() );
-        ASSERT ( frame + n <= _inputs[index].size() );
+        ASSERT ( frame + n <= _inputs[index].size );
 
-        std::copy ( _inputs[index].begin() + frame,
-                    _inputs[index].begin() + frame + n, t );
+        forEachPage ( _inputs[index], frame, n, [&] ( const T *page, size_t len )
+        {
+            t = std::copy ( page, page + len, t );
+        } );
     }
 
     // Set a single input for the given index:frame, CANNOT change existing inputs.
     void set ( uint32_t index, uint32_t frame, T t )
     {
-        if ( _inputs.size() > index && _inputs[index].size() > frame )
+        if ( _inputs.size() > index && _inputs[index].size > frame )
             return;
 
         resize ( index, frame );
@@ -58,32 +82,58 @@ public:
     {
         resize ( index, frame, n );
 
-        std::fill ( _inputs[index].begin() + frame,
-                    _inputs[index].begin() + frame + n, t );
+        forEachPage ( _inputs[index], frame, n, [&] ( T *page, size_t len )
+        {
+            std::fill ( page, page + len, t );
+        } );
     }
 
     // Set n inputs starting from the given index:frame, CAN change existing inputs.
     void set ( uint32_t index, uint32_t frame, const T *t, size_t n, uint32_t checkStartingFromIndex = UINT_MAX )
     {
+        size_t i = n;
+
         if ( index >= checkStartingFromIndex )
         {
-            IndexedFrame f;
-            size_t i;
+            i = findFirstChange ( index, frame, t, n );
 
-            for ( i = 0, f = {{ frame, index }}; i < n; ++i, ++f.parts.frame )
+            // Indicate changed if the input is different from the last known or predicted input
+            if ( i < n )
             {
-                if ( get ( f.parts.index, f.parts.frame ) == t[i] )
-                    continue;
-
-                // Indicate changed if the input is different from the last known input
+                const IndexedFrame f = {{ uint32_t ( frame + i ), index }};
                 _lastChangedFrame.value = std::min ( _lastChangedFrame.value, f.value );
-                break;
             }
         }
 
         resize ( index, frame, n );
 
-        std::copy ( t, t + n, &_inputs[index][frame] );
+        forEachPage ( _inputs[index], frame, n, [&] ( T *page, size_t len )
+        {
+            std::copy ( t, t + len, page );
+            t += len;
+        } );
+
+        // The remaining predictions were made without the changed input, so they should be predicted again
+        if ( i < n )
+            _predicted.clear();
+    }
+
+    // Predict the input for the given index:frame after the last known input of the newest index.
+    // Predictions are returned by get and compared by set, until they are replaced by actual inputs.
+    // CANNOT change existing predictions, and any skipped frames are predicted as the last known input.
+    void predict ( uint32_t index, uint32_t frame, T t )
+    {
+        if ( index + 1 != _inputs.size() || _inputs[index].empty() || frame < getPredictedEndFrame() )
+            return;
+
+        _predicted.resize ( frame - _inputs[index].size, _inputs[index].back() );
+        _predicted.push_back ( t );
+    }
+
+    // Get the frame after the last known or predicted input of the newest index
+    uint32_t getPredictedEndFrame() const
+    {
+        return getEndFrame() + _predicted.size();
     }
 
     // Resize the container so that it can contain inputs up to index:frame+n.
@@ -95,19 +145,35 @@ public:
         {
             last = lastInputBefore ( _inputs.size() );
             _inputs.resize ( index + 1 );
+            _predicted.clear();
         }
         else if ( ! _inputs[index].empty() )
         {
             last = _inputs[index].back();
         }
 
-        if ( frame + n > _inputs[index].size() )
-            _inputs[index].resize ( frame + n, last );
+        if ( frame + n <= _inputs[index].size )
+            return;
+
+        const size_t size = _inputs[index].size;
+
+        grow ( _inputs[index], frame + n, last );
+
+        // Fill in the new frames with the predicted inputs, so get returns the same inputs as before
+        if ( index + 1 == _inputs.size() && ! _predicted.empty() )
+        {
+            const size_t count = std::min ( _predicted.size(), _inputs[index].size - size );
+
+            for ( size_t i = 0; i < count; ++i )
+                _inputs[index][size + i] = _predicted[i];
+
+            _predicted.erase ( _predicted.begin(), _predicted.begin() + count );
+        }
     }
 
     void clear()
     {
-        _inputs.clear();
+        eraseIndexOlderThan ( _inputs.size() );
     }
 
     bool empty() const
@@ -133,7 +199,7 @@ public:
         if ( _inputs.empty() )
             return 0;
 
-        return _inputs.back().size();
+        return _inputs.back().size;
     }
 
     uint32_t getEndFrame ( size_t index ) const
@@ -141,15 +207,22 @@ public:
         if ( index >= _inputs.size() )
             return 0;
 
-        return _inputs[index].size();
+        return _inputs[index].size;
     }
 
+    // Erase the oldest indices, the remaining indices are shifted down. Each erased index is O(1).
     void eraseIndexOlderThan ( size_t index )
     {
-        if ( index + 1 >= _inputs.size() )
-            _inputs.clear();
-        else
-            _inputs.erase ( _inputs.begin(), _inputs.begin() + index );
+        const size_t count = ( index + 1 >= _inputs.size() ? _inputs.size() : index );
+
+        if ( count == _inputs.size() )
+            _predicted.clear();
+
+        for ( size_t i = 0; i < count; ++i )
+        {
+            recycle ( _inputs.front() );
+            _inputs.pop_front();
+        }
     }
 
     IndexedFrame getLastChangedFrame() const
@@ -164,12 +237,204 @@ public:
 
 private:
 
-    // Mapping: index -> frame -> input
-    std::vector<std::vector<T>> _inputs;
+    typedef std::array<T, INPUTS_PAGE_SIZE> Page;
+
+    typedef std::unique_ptr<Page> PagePtr;
+
+    // Inputs of a single index, stored as fixed-size pages of frames
+    struct Frames
+    {
+        std::vector<PagePtr> pages;
+
+        size_t size = 0;
+
+        bool empty() const { return ( size == 0 ); }
+
+        T& operator[] ( size_t frame ) { return ( *pages[frame / INPUTS_PAGE_SIZE] ) [frame % INPUTS_PAGE_SIZE]; }
+
+        const T& operator[] ( size_t frame ) const
+        {
+            return ( *pages[frame / INPUTS_PAGE_SIZE] ) [frame % INPUTS_PAGE_SIZE];
+        }
+
+        const T& back() const { return ( *this ) [size - 1]; }
+    };
+
+    // Mapping: index -> frame -> input, older indices are popped from the front
+    std::deque<Frames> _inputs;
+
+    // Pages of erased indices, reused before allocating new pages
+    std::vector<PagePtr> _freePages;
+
+    // Predicted inputs after the last known input of the newest index
+    std::vector<T> _predicted;
 
     // Last frame of input that changed
     IndexedFrame _lastChangedFrame = MaxIndexedFrame;
 
+    // Call func ( page, len ) for each contiguous run of n frames starting from the given frame
+    template<typename F, typename P>
+    static void forEachPage ( P& frames, size_t frame, size_t n, const F& func )
+    {
+        while ( n > 0 )
+        {
+            const size_t offset = frame % INPUTS_PAGE_SIZE;
+            const size_t len = std::min<size_t> ( n, INPUTS_PAGE_SIZE - offset );
+
+            func ( &( *frames.pages[frame / INPUTS_PAGE_SIZE] ) [offset], len );
+
+            frame += len;
+            n -= len;
+        }
+    }
+
+    // Find the first of the n given inputs that is different from get ( index, frame + i ), returns n if none.
+    // Known inputs are compared a page at a time, the rest against the predicted or last known input.
+    size_t findFirstChange ( uint32_t index, uint32_t frame, const T *t, size_t n ) const
+    {
+        size_t i = 0;
+        T last;
+
+        if ( index < _inputs.size() && ! _inputs[index].empty() )
+        {
+            const Frames& frames = _inputs[index];
+            const size_t known = ( frame < frames.size ? std::min<size_t> ( n, frames.size - frame ) : 0 );
+
+            while ( i < known )
+            {
+                const size_t offset = ( frame + i ) % INPUTS_PAGE_SIZE;
+                const size_t len = std::min<size_t> ( known - i, INPUTS_PAGE_SIZE - offset );
+                const size_t j = firstMismatch ( &( *frames.pages[( frame + i ) / INPUTS_PAGE_SIZE] ) [offset],
+                                                 t + i, len );
+
+                if ( j < len )
+                    return i + j;
+
+                i += len;
+            }
+
+            last = frames.back();
+
+            // Compare against the predicted inputs
+            if ( index + 1 == _inputs.size() )
+            {
+                for ( ; i < n && frame + i - frames.size < _predicted.size(); ++i )
+                {
+                    if ( t[i] != _predicted[frame + i - frames.size] )
+                        return i;
+                }
+            }
+        }
+        else
+        {
+            last = lastInputBefore ( index );
+        }
+
+        for ( ; i < n; ++i )
+        {
+            if ( t[i] != last )
+                break;
+        }
+
+        return i;
+    }
+
+    // Find the first of n inputs that differ between a and b, returns n if none. Compares raw bytes.
+    static size_t firstMismatch ( const T *a, const T *b, size_t n )
+    {
+        const size_t bytes = n * sizeof ( T );
+        size_t i = 0;
+
+#ifdef INPUTS_SSE2
+        if ( hasSse2() )
+            i = firstMismatchSse2 ( ( const char * ) a, ( const char * ) b, bytes );
+#endif // INPUTS_SSE2
+
+        // Compare the remaining bytes a word at a time, then narrow down to the input
+        for ( ; i + sizeof ( uint64_t ) <= bytes; i += sizeof ( uint64_t ) )
+        {
+            uint64_t x, y;
+            std::memcpy ( &x, ( const char * ) a + i, sizeof ( x ) );
+            std::memcpy ( &y, ( const char * ) b + i, sizeof ( y ) );
+
+            if ( x != y )
+                break;
+        }
+
+        for ( i /= sizeof ( T ); i < n; ++i )
+        {
+            if ( a[i] != b[i] )
+                break;
+        }
+
+        return i;
+    }
+
+#ifdef INPUTS_SSE2
+    static bool hasSse2()
+    {
+        static const bool sse2 = __builtin_cpu_supports ( "sse2" );
+        return sse2;
+    }
+
+    // Compare 16 bytes at a time, returns the offset of the first differing block, or the end of the whole blocks
+    __attribute__ ( ( target ( "sse2" ) ) )
+    static size_t firstMismatchSse2 ( const char *a, const char *b, size_t bytes )
+    {
+        size_t i = 0;
+
+        for ( ; i + sizeof ( __m128i ) <= bytes; i += sizeof ( __m128i ) )
+        {
+            const __m128i x = _mm_loadu_si128 ( ( const __m128i * ) ( a + i ) );
+            const __m128i y = _mm_loadu_si128 ( ( const __m128i * ) ( b + i ) );
+
+            if ( _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( x, y ) ) != 0xFFFF )
+                break;
+        }
+
+        return i;
+    }
+#endif // INPUTS_SSE2
+
+    // Grow the frames to the given size, filling the new frames with the given value
+    void grow ( Frames& frames, size_t size, T last )
+    {
+        while ( frames.pages.size() * INPUTS_PAGE_SIZE < size )
+        {
+            if ( _freePages.empty() )
+            {
+                frames.pages.push_back ( PagePtr ( new Page() ) );
+            }
+            else
+            {
+                frames.pages.push_back ( std::move ( _freePages.back() ) );
+                _freePages.pop_back();
+            }
+        }
+
+        forEachPage ( frames, frames.size, size - frames.size, [&] ( T *page, size_t len )
+        {
+            std::fill ( page, page + len, last );
+        } );
+
+        frames.size = size;
+    }
+
+    // Return the pages of the frames for reuse
+    void recycle ( Frames& frames )
+    {
+        for ( PagePtr& page : frames.pages )
+        {
+            if ( _freePages.size() >= MAX_FREE_INPUTS_PAGES )
+                break;
+
+            _freePages.push_back ( std::move ( page ) );
+        }
+
+        frames.pages.clear();
+        frames.size = 0;
+    }
+
     // Get the last known input BEFORE the given index. Defaults to 0 if unknown.
     T lastInputBefore ( uint32_t index ) const
     {
@@ -296,6 +296,21 @@ struct RngState : public SerializableSequence
 };
 
 
+struct StateHashes : public SerializableSequence
+{
+    IndexedFrame indexedFrame = {{ 0, 0 }};
+
+    // Hash of each MemDumpList region of the game state at indexedFrame
+    std::vector<uint32_t> hashes;
+
+    StateHashes ( IndexedFrame indexedFrame ) : indexedFrame ( indexedFrame ) {}
+
+    std::string str() const override { return format ( "StateHashes[%s]", indexedFrame ); }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( StateHashes, indexedFrame.value, hashes )
+};
+
+
 struct SyncHash : public SerializableSequence
 {
     IndexedFrame indexedFrame = {{ 0, 0 }};
@@ -417,6 +432,76 @@ struct MenuIndex : public SerializableSequence
 };
 
 
+// Sent from a spectator to the client it is spectating, describing the spectators below it
+struct SpectatorSubtree : public SerializableSequence
+{
+    // Number of spectators below the sender
+    uint32_t numSpectators = 0;
+
+    // Number of spectators that can still join the sender or below it
+    uint32_t freeSlots = 0;
+
+    // Depth of the shallowest free slot relative to the sender, ie 0 if the sender has free slots
+    uint8_t freeDepth = UINT8_MAX;
+
+    // Highest spectator delay of the sender or below it, in frames
+    uint32_t maxDelay = 0;
+
+    std::string str() const override
+    {
+        return format ( "SpectatorSubtree[%u,%u,%u,%u]", numSpectators, freeSlots, freeDepth, maxDelay );
+    }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( SpectatorSubtree, numSpectators, freeSlots, freeDepth, maxDelay )
+};
+
+
+// Sent periodically from the players to their spectators, and forwarded down the spectator tree as soon as it arrives
+struct SpectatorDepth : public SerializableSequence
+{
+    // Depth of the receiver in the spectator tree, the players are at depth 0
+    uint8_t depth = 0;
+
+    // Position of the players when this was sent
+    IndexedFrame liveIndexedFrame = {{ 0, 0 }};
+
+    SpectatorDepth ( uint8_t depth, IndexedFrame liveIndexedFrame )
+        : depth ( depth ), liveIndexedFrame ( liveIndexedFrame ) {}
+
+    std::string str() const override { return format ( "SpectatorDepth[%u,%s]", depth, liveIndexedFrame ); }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( SpectatorDepth, depth, liveIndexedFrame.value )
+};
+
+
+// Chunk of a compressed game state that a spectator loads instead of running every frame before it
+struct SpectatorKeyframe : public SerializableSequence
+{
+    // Frame of the game state
+    IndexedFrame indexedFrame = {{ 0, 0 }};
+
+    // Total size of the compressed game state, and the offset of this chunk
+    uint32_t size = 0, offset = 0;
+
+    // Bytes of this chunk
+    std::string data;
+
+    SpectatorKeyframe ( IndexedFrame indexedFrame, uint32_t size, uint32_t offset, const std::string& data )
+        : indexedFrame ( indexedFrame ), size ( size ), offset ( offset ), data ( data )
+    {
+        // Already compressed
+        compressionLevel = 0;
+    }
+
+    std::string str() const override
+    {
+        return format ( "SpectatorKeyframe[%s,%u+%u/%u]", indexedFrame, offset, data.size(), size );
+    }
+
+    PROTOCOL_MESSAGE_BOILERPLATE ( SpectatorKeyframe, indexedFrame.value, size, offset, data )
+};
+
+
 struct ChangeConfig : public SerializableSequence
 {
     ENUM_BOILERPLATE ( ChangeConfig, Delay, Rollback, RollbackDelay )
@@ -471,14 +556,60 @@ struct BaseInputs
 
 struct PlayerInputs : public SerializableMessage, public BaseInputs
 {
-    // Represents the input range [frame - NUM_INPUTS + 1, frame + 1)
+    // Represents the input range [frame - count + 1, frame + 1), only the first count inputs are sent
     std::array<uint16_t, NUM_INPUTS> inputs;
 
-    PlayerInputs ( IndexedFrame indexedFrame ) { this->indexedFrame = indexedFrame; }
+    // Number of inputs, defaults to NUM_INPUTS or as many frames as there are
+    uint8_t count = 0;
+
+    // End of the sender's contiguous inputs from the receiver, ie the next frame it needs
+    IndexedFrame ackedEndFrame = {{ 0, 0 }};
+
+    // Hash of the sender's newest confirmed game state, at hashFrame in the same index, UINT_MAX if none
+    uint32_t hashFrame = UINT_MAX, stateHash = 0;
+
+    // Sender's average number of frames ahead of the inputs it has received, for time synchronization
+    int8_t frameAdvantage = 0;
+
+    PlayerInputs ( IndexedFrame indexedFrame )
+    {
+        this->indexedFrame = indexedFrame;
+        count = BaseInputs::size();
+    }
+
+    // Only send the inputs starting from the given frame, at most NUM_INPUTS and at least the newest input
+    void setStartFrame ( uint32_t startFrame )
+    {
+        count = getEndFrame() - clamped ( startFrame, BaseInputs::getStartFrame(), getFrame() );
+    }
+
+    uint32_t getStartFrame() const { return getEndFrame() - count; }
+
+    size_t size() const { return count; }
+
+    std::string str() const override { return format ( "PlayerInputs[%s,%u]", indexedFrame, count ); }
+
+    EMPTY_MESSAGE_BOILERPLATE ( PlayerInputs )
+
+    void save ( cereal::BinaryOutputArchive& ar ) const override
+    {
+        ar ( indexedFrame.value, count, ackedEndFrame.value, hashFrame, stateHash, frameAdvantage );
+
+        for ( size_t i = 0; i < count; ++i )
+            ar ( inputs[i] );
+    }
 
-    std::string str() const override { return format ( "PlayerInputs[%s]", indexedFrame ); }
+    void load ( cereal::BinaryInputArchive& ar ) override
+    {
+        ar ( indexedFrame.value, count, ackedEndFrame.value, hashFrame, stateHash, frameAdvantage );
 
-    PROTOCOL_MESSAGE_BOILERPLATE ( PlayerInputs, indexedFrame.value, inputs )
+        // The remaining inputs would be left in the archive, so the message can't be decoded
+        if ( count > BaseInputs::size() )
+            throw cereal::Exception ( format ( "PlayerInputs count=%u", count ) );
+
+        for ( size_t i = 0; i < count; ++i )
+            ar ( inputs[i] );
+    }
 };
 
 
@@ -37,7 +37,13 @@ ENUM ( Options,
        AppDir,
        SessionId,
        HeldStartDuration,
-       ReplayRollbackOn );
+       ReplayRollbackOn,
+       AsyncSave,
+       SaveInterval,
+       PreserveIndices,
+       Prediction,
+       AutoDelay,
+       MaxSpectators );
 
 
 // Forward declaration
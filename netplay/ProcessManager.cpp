@@ -77,6 +77,30 @@ void ProcessManager::socketRead ( Socket *socket, const MsgPtr& msg, const IpAdd
     ASSERT ( socket == _ipcSocket.get() );
     ASSERT ( address.addr == "127.0.0.1" );
 
+    ipcReadInternal ( msg );
+}
+
+void ProcessManager::pipeDisconnected ( SharedMemoryPipe *pipe )
+{
+    ASSERT ( pipe == _ipcPipe.get() );
+
+    disconnectPipe();
+
+    LOG ( "IPC disconnected" );
+
+    if ( owner )
+        owner->ipcDisconnected();
+}
+
+void ProcessManager::pipeRead ( SharedMemoryPipe *pipe, const MsgPtr& msg )
+{
+    ASSERT ( pipe == _ipcPipe.get() );
+
+    ipcReadInternal ( msg );
+}
+
+void ProcessManager::ipcReadInternal ( const MsgPtr& msg )
+{
     if ( msg && msg->getMsgType() == MsgType::IpcConnected )
     {
         ASSERT ( _connected == false );
@@ -206,12 +230,6 @@ void ProcessManager::openGame ( bool highPriority )
     if ( bytes != sizeof ( ipcHost.port ) )
         THROW_EXCEPTION ( "read %d bytes, expected %d", ERROR_PIPE_RW, bytes, sizeof ( ipcHost.port ) );
 
-    LOG ( "ipcHost='%s'", ipcHost );
-
-    _ipcSocket = TcpSocket::connect ( this, ipcHost );
-
-    LOG ( "ipcSocket=%08x", _ipcSocket.get() );
-
     if ( ! ReadFile ( _pipe, &_processId, sizeof ( _processId ), &bytes, 0 ) )
         THROW_WIN_EXCEPTION ( GetLastError(), "ReadFile failed", ERROR_PIPE_RW );
 
@@ -220,6 +238,27 @@ void ProcessManager::openGame ( bool highPriority )
 
     LOG ( "processId=%08x", _processId );
 
+    // A port of 0 means the DLL created a shared memory pipe instead of listening on a socket
+    if ( ipcHost.port == 0 )
+    {
+        _ipcPipe = SharedMemoryPipe::open ( this, getPipeName ( _processId ) );
+
+        if ( ! _ipcPipe )
+            THROW_WIN_EXCEPTION ( GetLastError(), "SharedMemoryPipe::open failed", ERROR_PIPE_RW );
+
+        LOG ( "ipcPipe=%08x", _ipcPipe.get() );
+
+        _ipcPipe->send ( new IpcConnected() );
+    }
+    else
+    {
+        LOG ( "ipcHost='%s'", ipcHost );
+
+        _ipcSocket = TcpSocket::connect ( this, ipcHost );
+
+        LOG ( "ipcSocket=%08x", _ipcSocket.get() );
+    }
+
     _gameStartTimer.reset ( new Timer ( this ) );
     _gameStartTimer->start ( GAME_START_INTERVAL );
     _gameStartCount = 0;
@@ -247,6 +286,7 @@ void ProcessManager::disconnectPipe()
 {
     _gameStartTimer.reset();
     _ipcSocket.reset();
+    _ipcPipe.reset();
 
     if ( _pipe )
     {
@@ -432,9 +472,20 @@ bool ProcessManager::isWine()
 }
 
 
+string ProcessManager::getPipeName ( int processId )
+{
+    return format ( "Local\\cccaster_ipc_%08x", processId );
+}
+
 bool ProcessManager::isConnected() const
 {
-    return ( _pipe && _ipcSocket && _ipcSocket->isClient() && _connected );
+    if ( ! _pipe || ! _connected )
+        return false;
+
+    if ( _ipcPipe )
+        return _ipcPipe->isConnected();
+
+    return ( _ipcSocket && _ipcSocket->isClient() );
 }
 
 bool ProcessManager::ipcSend ( Serializable& msg )
@@ -451,6 +502,8 @@ bool ProcessManager::ipcSend ( const MsgPtr& msg )
 {
     if ( ! isConnected() )
         return false;
+    else if ( _ipcPipe )
+        return _ipcPipe->send ( msg );
     else
         return _ipcSocket->send ( msg );
 }
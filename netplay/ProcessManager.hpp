@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Socket.hpp"
+#include "SharedMemoryPipe.hpp"
 #include "Timer.hpp"
 #include "Protocol.hpp"
 #include "Messages.hpp"
@@ -18,6 +19,7 @@ struct IpcConnected : public SerializableSequence { EMPTY_MESSAGE_BOILERPLATE (
 
 class ProcessManager
     : private Socket::Owner
+    , private SharedMemoryPipe::Owner
     , private Timer::Owner
 {
 public:
@@ -67,14 +69,15 @@ public:
     void openGame ( bool highPriority = false );
     void closeGame();
 
-    // Connect / disconnect the IPC pipe and socket from the DLL side
+    // Connect / disconnect the IPC pipe and socket from the DLL side.
+    // This uses a shared memory pipe if possible, otherwise falls back to a localhost TCP socket.
     void connectPipe();
     void disconnectPipe();
 
     // Indicates if the IPC pipe and socket are connected
     bool isConnected() const;
 
-    // Send a message over the IPC socket
+    // Send a message over the IPC shared memory pipe or socket
     bool ipcSend ( Serializable& msg );
     bool ipcSend ( Serializable *msg );
     bool ipcSend ( const MsgPtr& msg );
@@ -108,9 +111,12 @@ private:
     // Process ID
     int _processId = 0;
 
-    // IPC socket
+    // IPC socket, only used if the shared memory pipe couldn't be created
     SocketPtr _ipcSocket;
 
+    // IPC shared memory pipe
+    SharedMemoryPipePtr _ipcPipe;
+
     // Game start timer
     TimerPtr _gameStartTimer;
 
@@ -126,6 +132,16 @@ private:
     void socketDisconnected ( Socket *socket ) override;
     void socketRead ( Socket *socket, const MsgPtr& msg, const IpAddrPort& address ) override;
 
+    // IPC shared memory pipe callbacks
+    void pipeDisconnected ( SharedMemoryPipe *pipe ) override;
+    void pipeRead ( SharedMemoryPipe *pipe, const MsgPtr& msg ) override;
+
+    // Handle an IPC message from either transport
+    void ipcReadInternal ( const MsgPtr& msg );
+
+    // Get the name of the shared memory pipe for the given game process ID
+    static std::string getPipeName ( int processId );
+
     // IPC connect timer callback
     void timerExpired ( Timer *timer ) override;
 };
@@ -35,6 +35,8 @@ public:
 
     uint32_t getLastFrame() const;
 
+    uint32_t getEndFrame ( uint32_t index ) const;
+
     MsgPtr getInitialStateBefore ( uint32_t index ) const;
 
 private:
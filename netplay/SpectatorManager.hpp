@@ -6,16 +6,31 @@
 
 #include <unordered_map>
 #include <list>
+#include <map>
+#include <memory>
 
 
 // Default pending socket timeout
 #define DEFAULT_PENDING_TIMEOUT ( 20000 )
 
+// Maximum depth of the spectator tree that new spectators are redirected to. Each level adds up to one broadcast
+// interval, ie NUM_INPUTS / 2 frames, plus the network latency between the levels to the spectator delay.
+#define MAX_SPECTATOR_DEPTH ( 4 )
+
+// Minimum number of frames a spectator must be behind the players before it is sent a keyframe to catch up from,
+// a spectator closer than this just fast-forwards
+#define MIN_KEYFRAME_FRAMES ( 180 )
+
+// Number of keyframe bytes sent to each spectator per frame
+#define KEYFRAME_CHUNK_SIZE ( 4096 )
+
 
 // Forward declarations
 struct RngState;
+struct SpectatorKeyframe;
 struct NetplayManager;
 struct ProcessManager;
+class DllRollbackManager;
 
 
 struct Spectator
@@ -29,6 +44,29 @@ struct Spectator
     IpAddrPort serverAddr;
 
     std::list<Socket *>::iterator it;
+
+    // Last reported SpectatorSubtree, null until the spectator reports it
+    MsgPtr subtree;
+
+    // Keyframe being sent to this spectator, null if none
+    std::shared_ptr<const std::string> keyframe;
+
+    IndexedFrame keyframeFrame = {{ 0, 0 }};
+
+    // Number of keyframe bytes sent so far
+    uint32_t keyframeOffset = 0;
+};
+
+
+// Message that is encoded once and sent to every spectator at the same position
+struct SpectatorBroadcast
+{
+    MsgPtr msg;
+
+    std::string bytes;
+
+    // Position after sending this message, only changed for BothInputs
+    IndexedFrame pos = {{ 0, 0 }};
 };
 
 
@@ -40,10 +78,19 @@ public:
     // Changing this value will only affect newly accepted sockets; already accepted sockets are unaffected.
     uint64_t pendingSocketTimeout = DEFAULT_PENDING_TIMEOUT;
 
+    // Maximum number of spectators served directly, depends on the upload bandwidth available
+    uint32_t maxSpectators = 0;
+
+    // Depth in the spectator tree, the players are at depth 0
+    uint8_t spectatorDepth = 0;
+
+    // Number of frames behind the players, 0 for the players
+    uint32_t spectatorDelay = 0;
+
 
     SpectatorManager();
 
-    SpectatorManager ( NetplayManager *netManPtr, const ProcessManager *procManPtr );
+    SpectatorManager ( NetplayManager *netManPtr, const ProcessManager *procManPtr, DllRollbackManager *rollManPtr );
 
 
     bool isPendingSocket ( Socket *socket ) const { return ( _pendingSockets.find ( socket ) != _pendingSockets.end() ); }
@@ -64,12 +111,48 @@ public:
     const IpAddrPort& getRandomSpectatorAddress() const;
 
 
+    // Update the spectators below the given spectator
+    void setSpectatorSubtree ( Socket *socket, const MsgPtr& subtree );
+
+    // Get the SpectatorSubtree describing this client and the spectators below it
+    MsgPtr getSpectatorSubtree() const;
+
+    // Get the server address of the spectator with the shallowest free slot below it, preferring more free slots.
+    // The given client and its SpectatorSubtree are also considered, ie the netplay client when hosting.
+    // Returns NullAddress if no free slots have been reported.
+    const IpAddrPort& getFreeSpectatorAddress ( const IpAddrPort& clientAddr, const MsgPtr& clientSubtree ) const;
+
+    // Send the depth of our spectators and the position of the players to our spectators
+    void sendSpectatorDepth ( uint8_t depth, const IndexedFrame& liveIndexedFrame );
+
+
+    // Add a chunk of the keyframe received while spectating, chunks are resumed from the last complete offset
+    void gotKeyframeChunk ( const SpectatorKeyframe& chunk );
+
+    // Get the frame of the latest keyframe, complete or not
+    const IndexedFrame& getKeyframeFrame() const { return _keyframeFrame; }
+
+    // Get the latest keyframe, null if it is still being received
+    const std::shared_ptr<const std::string>& getKeyframe() const { return _keyframe; }
+
+
     void newRngState ( const RngState& rngState );
 
     void frameStepSpectators();
 
 private:
 
+    // Get the message to broadcast for the given position, only encoded once per frame.
+    // Only BothInputs, RngState, and MenuIndex messages are supported.
+    const SpectatorBroadcast& getBroadcast ( MsgType type, const IndexedFrame& pos );
+
+    // Start sending a keyframe to the spectator if it is far enough behind, or if we don't have the inputs before our
+    // own keyframe. Returns false if the spectator must wait for our keyframe to finish being received first.
+    bool startKeyframe ( Socket *socket, Spectator& spectator );
+
+    // Send the next chunk of the spectator's keyframe
+    void sendKeyframeChunk ( Socket *socket, Spectator& spectator );
+
     std::unordered_map<Socket *, SocketPtr> _pendingSockets;
 
     std::unordered_map<Socket *, TimerPtr> _pendingSocketTimers;
@@ -86,7 +169,22 @@ private:
 
     uint32_t _currentMinIndex = UINT_MAX;
 
+    // Messages broadcast during the current frame, mapping: { position, message type } -> broadcast
+    std::map<std::pair<uint64_t, MsgType>, SpectatorBroadcast> _broadcasts;
+
+    // Latest keyframe, either taken from the rollback game states, or received while spectating
+    std::shared_ptr<const std::string> _keyframe;
+
+    IndexedFrame _keyframeFrame = MaxIndexedFrame;
+
+    // Keyframe bytes received so far, and the total size
+    std::string _keyframeBuffer;
+
+    uint32_t _keyframeSize = 0;
+
     NetplayManager *_netManPtr = 0;
 
     const ProcessManager *_procManPtr = 0;
+
+    DllRollbackManager *_rollManPtr = 0;
 };
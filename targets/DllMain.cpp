@@ -16,6 +16,9 @@
 #include "DllFrameRate.hpp"
 #include "ReplayManager.hpp"
 #include "DllRollbackManager.hpp"
+#include "DllRollbackStats.hpp"
+#include "DelayTuner.hpp"
+#include "MemCapture.hpp"
 
 #include <windows.h>
 
@@ -29,9 +32,26 @@ using namespace std;
 // The main log file path
 #define LOG_FILE                    FOLDER "dll.log"
 
+// The persistent savestate file for training mode
+#define SAVE_STATE_FILE             FOLDER "savestates.bin"
+
+// The memory range captured for tools/MemDiscover, this covers the game's static data
+#define CC_CAPTURE_BEGIN_ADDR       ( ( char * ) 0x54E000 )
+#define CC_CAPTURE_END_ADDR         ( ( char * ) 0x7B2000 )
+
 // The number of milliseconds to poll for events each frame
 #define POLL_TIMEOUT                ( 3 )
 
+// The normal game frame rate
+#define NORMAL_FPS                  ( 60.0 )
+
+// The minimum and maximum number of frames ahead of the remote side that are corrected by slowing down
+#define MIN_TIME_SYNC_FRAMES        ( 1.0 )
+#define MAX_TIME_SYNC_FRAMES        ( 9.0 )
+
+// The number of frames to spread each time sync correction over
+#define TIME_SYNC_SPAN              ( 60.0 )
+
 // The extra number of frames to delay checking round over state during rollback
 #define ROLLBACK_ROUND_OVER_DELAY   ( 5 )
 
@@ -47,16 +67,17 @@ using namespace std;
 // The maximum number of milliseconds to wait for inputs before timeout
 #define MAX_WAIT_INPUTS_INTERVAL    ( 10000 )
 
-// The maximum number of spectators allowed for ClientMode::Spectate
+// The default maximum number of spectators allowed for ClientMode::Spectate
 #define MAX_SPECTATORS              ( 15 )
 
-// The maximum number of spectators allowed for ClientMode::Host/Client
+// The default maximum number of spectators allowed for ClientMode::Host/Client
 #define MAX_ROOT_SPECTATORS         ( 1 )
 
 // Indicates if this client should redirect spectators
-#define SHOULD_REDIRECT_SPECTATORS  ( clientMode.isSpectate()                                                       \
-                                      ? numSpectators() >= MAX_SPECTATORS                                           \
-                                      : numSpectators() >= MAX_ROOT_SPECTATORS )
+#define SHOULD_REDIRECT_SPECTATORS  ( numSpectators() >= maxSpectators )
+
+// The number of frames between each update of the spectator tree
+#define SPECTATOR_TREE_INTERVAL     ( 60 )
 
 
 #define LOG_SYNC(FORMAT, ...)                                                                                       \
@@ -145,6 +166,12 @@ struct DllMain
     // Client serverCtrlSocket address
     IpAddrPort clientServerAddr;
 
+    // Last SpectatorSubtree reported by the client
+    MsgPtr clientSubtree;
+
+    // Frames until the next update of the spectator tree
+    int spectatorTreeTimer = 0;
+
     // Sockets that have been redirected to another client
     unordered_set<Socket *> redirectedSockets;
 
@@ -157,6 +184,21 @@ struct DllMain
     // If we should fast-forward when spectating
     bool spectateFastFwd = true;
 
+    // If the frame rate is being adjusted to stay in sync with the remote side
+    bool timeSyncActive = false;
+
+    // If the rollback stats should be shown in the overlay
+    bool showRollbackStats = false;
+
+    // Recommends the delay and rollback during rollback netplay
+    DelayTuner delayTuner;
+
+    // 0 to disable the delay and rollback recommendations, 1 to show them at the start of each round, 2 to apply them
+    uint8_t autoDelay = 0;
+
+    // Frame of the last training mode savestate, MaxIndexedFrame if none
+    IndexedFrame trainingStateFrame = MaxIndexedFrame;
+
     // The minimum number of frames that must run normally, before we're allowed to do another rollback
     uint8_t minRollbackSpacing = 2;
 
@@ -177,8 +219,100 @@ struct DllMain
     IndexedFrame replayStop = MaxIndexedFrame;
     IndexedFrame replayCheck = MaxIndexedFrame;
     string replayCheckRngHexStr;
+
+    // Memory capture for tools/MemDiscover
+    MemCaptureWriter memCapture;
 #endif // NOT RELEASE
 
+    // Index of the last detected desync, so it's only reported once per index
+    uint32_t desyncIndex = UINT_MAX;
+
+    // Save the current game state (Ctrl+F5), or jump back to the last saved state (F5)
+    void trainingSaveState ( bool save )
+    {
+        if ( ! rollMan.isSaveStateFileOpen()
+                && ! rollMan.openSaveStateFile ( ProcessManager::appDir + SAVE_STATE_FILE ) )
+        {
+            DllOverlayUi::showMessage ( "Failed to open " SAVE_STATE_FILE );
+            return;
+        }
+
+        if ( save )
+        {
+            if ( rollMan.persistState ( netMan ) )
+            {
+                trainingStateFrame = netMan.getIndexedFrame();
+                DllOverlayUi::showMessage ( format ( "Saved state [%s]", trainingStateFrame ) );
+            }
+            return;
+        }
+
+        // Only jump within the current index, the inputs from other indices are gone
+        if ( trainingStateFrame.parts.index != netMan.getIndex() )
+        {
+            DllOverlayUi::showMessage ( "No saved state" );
+            return;
+        }
+
+        IndexedFrame target = trainingStateFrame;
+
+        if ( rollMan.loadPersistedState ( target, netMan ) )
+            DllOverlayUi::showMessage ( format ( "Loaded state [%s]", target ) );
+    }
+
+    void checkStateHashes()
+    {
+        const IndexedFrame confirmedFrame = netMan.getConfirmedFrame();
+
+        if ( confirmedFrame.value == MaxIndexedFrame.value )
+            return;
+
+        // Send the hash of the newest confirmed state along with the local inputs
+        IndexedFrame hashFrame = confirmedFrame;
+        uint32_t hash;
+
+        if ( rollMan.getStateHash ( hashFrame, hash ) && hashFrame.parts.index == netMan.getIndex() )
+            netMan.setLocalStateHash ( hashFrame, hash );
+
+        // Only compare the remote hash once the same frame is confirmed locally
+        const IndexedFrame remoteHashFrame = netMan.getRemoteHashFrame();
+
+        if ( remoteHashFrame.value == MaxIndexedFrame.value )
+            return;
+
+        if ( remoteHashFrame.parts.index == netMan.getIndex() && remoteHashFrame.value > confirmedFrame.value )
+            return;
+
+        const uint32_t remoteHash = netMan.getRemoteStateHash();
+        netMan.clearRemoteStateHash();
+
+        hashFrame = remoteHashFrame;
+
+        if ( ! rollMan.getStateHash ( hashFrame, hash ) || hashFrame.value != remoteHashFrame.value )
+            return;
+
+        if ( hash == remoteHash || desyncIndex == netMan.getIndex() )
+            return;
+
+        desyncIndex = netMan.getIndex();
+
+        LOG_TO ( syncLog, "Desync: [%s] localHash=%08x; remoteHash=%08x", hashFrame, hash, remoteHash );
+
+        DllOverlayUi::showMessage ( format ( "Desync detected at [%s]", hashFrame ) );
+
+        // Dump the game state, this can be compared with the remote dump using tools/DesyncDiff
+        rollMan.dumpState ( hashFrame, ProcessManager::appDir + format ( "desync_%u_%u_p%u.dump",
+                            hashFrame.parts.index, hashFrame.parts.frame, localPlayer ) );
+
+        // Send the region hashes so both sides can find the memory regions that differ
+        StateHashes *stateHashes = new StateHashes ( hashFrame );
+
+        if ( dataSocket && rollMan.getRegionHashes ( hashFrame, stateHashes->hashes ) )
+            dataSocket->send ( MsgPtr ( stateHashes ) );
+        else
+            delete stateHashes;
+    }
+
     void frameStepNormal()
     {
         switch ( netMan.getState().value )
@@ -191,11 +325,19 @@ struct DllMain
                 break;
 
             case NetplayState::InGame:
+#ifndef RELEASE
+                // Capture memory at the same point the rollback states are saved
+                memCapture.capture ( netMan.getIndexedFrame().value );
+#endif // NOT RELEASE
+
                 if ( netMan.getRollback() )
                 {
                     // Only save rollback states in-game
                     rollMan.saveState ( netMan );
 
+                    if ( netMan.isInRollback() )
+                        checkStateHashes();
+
                     // Delayed round over check
                     if ( roundOverTimer > 0 )
                         --roundOverTimer;
@@ -299,6 +441,20 @@ struct DllMain
                         }
                     }
 
+                    if ( clientMode.isTraining() && netMan.isInGame()
+                            && KeyboardState::isPressed ( VK_F5 ) )                             // Training savestates
+                    {
+                        trainingSaveState ( KeyboardState::isDown ( VK_CONTROL ) );
+                    }
+
+                    if ( KeyboardState::isPressed ( VK_F8 ) )                                 // Toggle rollback stats
+                    {
+                        showRollbackStats = !showRollbackStats;
+
+                        if ( ! showRollbackStats )
+                            DllOverlayUi::showMessage ( "Hid rollback stats", 1000 );
+                    }
+
 #ifndef RELEASE
                     // Test random delay setting
                     if ( KeyboardState::isPressed ( VK_F11 ) )
@@ -314,6 +470,21 @@ struct DllMain
                         changeConfig.delay = rand() % 10;
                         changeConfig.invalidate();
                     }
+
+                    // Toggle capturing memory for tools/MemDiscover
+                    if ( KeyboardState::isPressed ( VK_F7 ) )
+                    {
+                        if ( memCapture.isOpen() )
+                        {
+                            memCapture.close();
+                            DllOverlayUi::showMessage ( format ( "Captured %u frames", memCapture.getNumFrames() ) );
+                        }
+                        else if ( memCapture.open ( ProcessManager::appDir + format ( "capture_%u.bin", time ( 0 ) ),
+                                                    CC_CAPTURE_BEGIN_ADDR, CC_CAPTURE_END_ADDR - CC_CAPTURE_BEGIN_ADDR ) )
+                        {
+                            DllOverlayUi::showMessage ( "Started memory capture" );
+                        }
+                    }
 #endif // NOT RELEASE
                 }
                 else if ( clientMode.isSpectate() )                                         // Spectator controls
@@ -327,6 +498,10 @@ struct DllMain
                     break;
                 }
 
+                // Refresh the live rollback stats twice a second
+                if ( showRollbackStats && netMan.getFrame() % 30 == 0 && ! DllOverlayUi::isEnabled() )
+                    DllOverlayUi::showMessage ( RollbackStats::get().getSummary(), 1000 );
+
 #ifndef RELEASE
                 DllOverlayUi::debugText = format ( "%+d [%s]", netMan.getRemoteFrameDelta(), netMan.getIndexedFrame() );
                 DllOverlayUi::debugTextAlign = 1;
@@ -506,6 +681,9 @@ struct DllMain
         if ( rollbackTimer == minRollbackSpacing )
             netMan.clearLastChangedFrame();
 
+        // If this frame had to wait for remote inputs
+        bool waitedOnInputs = false;
+
         for ( ;; )
         {
             // Poll until we are ready to run
@@ -520,11 +698,33 @@ struct DllMain
                 break;
 
             // Check if we are ready to continue running, ie not waiting on remote input or RngState
-            const bool ready = ( netMan.isRemoteInputReady() && netMan.isRngStateReady ( shouldSyncRngState ) );
+            const bool remoteInputReady = netMan.isRemoteInputReady();
+            const bool ready = ( remoteInputReady && netMan.isRngStateReady ( shouldSyncRngState ) );
+
+            if ( ! remoteInputReady )
+                waitedOnInputs = true;
 
             // Don't resend inputs in spectator mode
             if ( clientMode.isSpectate() )
             {
+                // Jump to the keyframe instead of running the frames before it
+                if ( netMan.getIndex() == getKeyframeFrame().parts.index
+                        && netMan.getFrame() < getKeyframeFrame().parts.frame )
+                {
+                    // Wait for the rest of the keyframe
+                    if ( ! getKeyframe() )
+                        continue;
+
+                    if ( ! rollMan.loadKeyframe ( *getKeyframe(), netMan ) )
+                    {
+                        delayedStop ( ERROR_INTERNAL );
+                        return;
+                    }
+
+                    LOG_TO ( syncLog, "Keyframe: indexedFrame=[%s]", netMan.getIndexedFrame() );
+                    continue;
+                }
+
                 // Continue if ready
                 if ( ready )
                     break;
@@ -549,6 +749,14 @@ struct DllMain
             }
         }
 
+        if ( netMan.isInGame() )
+        {
+            RollbackStats::get().addFrame ( waitedOnInputs );
+
+            if ( autoDelay && netMan.isInRollback() )
+                delayTuner.addFrame ( waitedOnInputs );
+        }
+
         if ( rollbackTimer < minRollbackSpacing )
         {
             --rollbackTimer;
@@ -580,6 +788,9 @@ struct DllMain
 
                 LOG_SYNC ( "Reinputs: 0x%04x 0x%04x", netMan.getRawInput ( 1 ), netMan.getRawInput ( 2 ) );
 
+                if ( autoDelay && fastFwdStopFrame.parts.index == netMan.getIndex() )
+                    delayTuner.addRollback ( fastFwdStopFrame.parts.frame - netMan.getFrame() );
+
                 netMan.clearLastChangedFrame();
                 --rollbackTimer;
                 return;
@@ -624,6 +835,7 @@ struct DllMain
                                                                                                                "Input delay was changed to %u",
                                                      changeConfig.delay ) );
                 netMan.setDelay ( changeConfig.delay );
+                changeConfig.value = ChangeConfig::Delay;
                 procMan.ipcSend ( changeConfig );
             }
 
@@ -643,6 +855,7 @@ struct DllMain
                 DllOverlayUi::showMessage ( format ( "Rollback was changed to %u", changeConfig.rollback ) );
                 netMan.setRollback ( changeConfig.rollback );
                 minRollbackSpacing = clamped<uint8_t> ( netMan.getRollback(), 2, 4 );
+                changeConfig.value = ChangeConfig::Rollback;
                 procMan.ipcSend ( changeConfig );
             }
         }
@@ -938,6 +1151,25 @@ struct DllMain
         if ( netMan.isInRollback() && netMan.getFrame() > CC_PRE_GAME_INTRO_FRAMES && *CC_INTRO_STATE_ADDR )
             *CC_INTRO_STATE_ADDR = 0;
 
+        // Time sync
+        if ( netMan.isInRollback() )
+        {
+            if ( ! fastFwdStopFrame.value )
+            {
+                updateTimeSync();
+
+                const double latency = netMan.getInputLatency();
+
+                if ( autoDelay && latency >= 0 )
+                    delayTuner.addLatency ( latency );
+            }
+        }
+        else if ( timeSyncActive )
+        {
+            DllFrameRate::desiredFps = NORMAL_FPS;
+            timeSyncActive = false;
+        }
+
         // Perform the frame step
         if ( fastFwdStopFrame.value )
             frameStepRerun();
@@ -947,6 +1179,12 @@ struct DllMain
         // Update spectators
         frameStepSpectators();
 
+        if ( --spectatorTreeTimer < 0 )
+        {
+            updateSpectatorTree();
+            spectatorTreeTimer = SPECTATOR_TREE_INTERVAL;
+        }
+
         // Write game inputs
         procMan.writeGameInput ( localPlayer, netMan.getInput ( localPlayer ) );
         procMan.writeGameInput ( remotePlayer, netMan.getInput ( remotePlayer ) );
@@ -959,6 +1197,94 @@ struct DllMain
 #endif
     }
 
+    // Slow down slightly while ahead of the remote side, so neither side keeps rolling back or waiting on inputs
+    void updateTimeSync()
+    {
+        netMan.updateFrameAdvantage();
+
+        const double framesAhead = netMan.getFramesAhead();
+
+        if ( framesAhead >= MIN_TIME_SYNC_FRAMES )
+        {
+            // Run TIME_SYNC_SPAN frames in the time of TIME_SYNC_SPAN + framesAhead frames
+            DllFrameRate::desiredFps = NORMAL_FPS * TIME_SYNC_SPAN
+                                       / ( TIME_SYNC_SPAN + min ( framesAhead, MAX_TIME_SYNC_FRAMES ) );
+        }
+        else
+        {
+            DllFrameRate::desiredFps = NORMAL_FPS;
+        }
+
+        timeSyncActive = true;
+    }
+
+    // Show or apply the recommended delay and rollback, this is only done at the start of each round
+    void checkDelayTuner()
+    {
+        uint8_t delay, rollback;
+
+        if ( ! delayTuner.recommend ( netMan.getRollbackDelay(), netMan.getRollback(), delay, rollback ) )
+            return;
+
+        LOG ( "Recommended delay=%u; rollback=%u; latency=%.2f; jitter=%.2f",
+              delay, rollback, delayTuner.getMeanLatency(), delayTuner.getJitter() );
+
+        if ( autoDelay >= 2 )
+        {
+            shouldChangeDelayRollback = true;
+
+            changeConfig.value = ChangeConfig::Delay;
+            changeConfig.indexedFrame = netMan.getIndexedFrame();
+            changeConfig.delay = delay;
+            changeConfig.rollbackDelay = netMan.getRollbackDelay();
+            changeConfig.rollback = rollback;
+            changeConfig.invalidate();
+        }
+        else
+        {
+            DllOverlayUi::showMessage ( format ( "Recommended input delay %u and rollback %u\n"
+                                                 "Input latency %.1f frames, jitter %.1f frames",
+                                                 delay, rollback,
+                                                 delayTuner.getMeanLatency(), delayTuner.getJitter() ), 5000 );
+        }
+
+        delayTuner.clear();
+    }
+
+    // Report the spectators below us up the spectator tree, and send the position of the players down the tree
+    void updateSpectatorTree()
+    {
+        if ( clientMode.isSpectate() )
+        {
+            // Forwarded to the client we are spectating by the main process
+            procMan.ipcSend ( getSpectatorSubtree() );
+            return;
+        }
+
+        if ( clientMode.isClient() && dataSocket && dataSocket->isConnected() )
+            dataSocket->send ( getSpectatorSubtree() );
+
+        sendSpectatorDepth ( 1, netMan.getIndexedFrame() );
+    }
+
+    // Measure the spectator delay and forward the position of the players down the spectator tree
+    void gotSpectatorDepth ( const SpectatorDepth& depth )
+    {
+        spectatorDepth = depth.depth;
+
+        // This doesn't include the network latency from the players, which is small compared to the broadcast intervals
+        if ( depth.liveIndexedFrame.parts.index == netMan.getIndex()
+                && depth.liveIndexedFrame.parts.frame >= netMan.getFrame() )
+        {
+            spectatorDelay = depth.liveIndexedFrame.parts.frame - netMan.getFrame();
+        }
+
+        LOG ( "spectatorDepth=%u; spectatorDelay=%u; liveIndexedFrame=[%s]; indexedFrame=[%s]",
+              spectatorDepth, spectatorDelay, depth.liveIndexedFrame, netMan.getIndexedFrame() );
+
+        sendSpectatorDepth ( depth.depth + 1, depth.liveIndexedFrame );
+    }
+
     void netplayStateChanged ( NetplayState state )
     {
         // Catch invalid transitions
@@ -1014,6 +1340,9 @@ struct DllMain
         {
             if ( netMan.getRollback() )
                 rollMan.allocateStates();
+
+            if ( autoDelay && netMan.getRollback() && clientMode.isNetplay() )
+                checkDelayTuner();
         }
 
         // Leaving InGame
@@ -1226,7 +1555,7 @@ struct DllMain
             IpAddrPort redirectAddr;
 
             if ( SHOULD_REDIRECT_SPECTATORS )
-                redirectAddr = getRandomRedirectAddress();
+                redirectAddr = getRedirectAddress();
 
             if ( redirectAddr.port == 0 )
             {
@@ -1360,6 +1689,24 @@ struct DllMain
                 netMan.setRngState ( msg->getAs<RngState>() );
                 return;
 
+            case MsgType::SpectatorSubtree:
+                if ( socket == dataSocket.get() )
+                    clientSubtree = msg;
+                else
+                    setSpectatorSubtree ( socket, msg );
+
+                LOG ( "%s: socket=%08x; maxDelay=%u", msg, socket, msg->getAs<SpectatorSubtree>().maxDelay );
+                return;
+
+            case MsgType::StateHashes:
+            {
+                const string regions = rollMan.diffRegionHashes ( msg->getAs<StateHashes>() );
+
+                if ( ! regions.empty() )
+                    LOG_TO ( syncLog, "Desync: [%s] regions: %s", msg->getAs<StateHashes>().indexedFrame, regions );
+                return;
+            }
+
 #ifndef RELEASE
             case MsgType::SyncHash:
                 remoteSync.push_back ( msg );
@@ -1457,6 +1804,14 @@ struct DllMain
                         netMan.setRetryMenuIndex ( msg->getAs<MenuIndex>().index, msg->getAs<MenuIndex>().menuIndex );
                         return;
 
+                    case MsgType::SpectatorDepth:
+                        gotSpectatorDepth ( msg->getAs<SpectatorDepth>() );
+                        return;
+
+                    case MsgType::SpectatorKeyframe:
+                        gotKeyframeChunk ( msg->getAs<SpectatorKeyframe>() );
+                        return;
+
                     case MsgType::ErrorMessage:
                         delayedStop ( msg->getAs<ErrorMessage>().error );
                         return;
@@ -1503,6 +1858,23 @@ struct DllMain
                 
                 netMan.replayRollbackOn = options[Options::ReplayRollbackOn];
 
+                rollMan.asyncSave = options[Options::AsyncSave];
+
+                if ( options[Options::SaveInterval] )
+                    rollMan.maxSaveInterval = max ( 1u, lexical_cast<uint32_t> ( options.arg ( Options::SaveInterval ) ) );
+
+                if ( options[Options::PreserveIndices] )
+                    netMan.maxPreservedIndices = lexical_cast<uint32_t> ( options.arg ( Options::PreserveIndices ) );
+
+                if ( options[Options::AutoDelay] )
+                    autoDelay = lexical_cast<uint32_t> ( options.arg ( Options::AutoDelay ) );
+
+                if ( options[Options::Prediction] )
+                {
+                    const uint32_t prediction = lexical_cast<uint32_t> ( options.arg ( Options::Prediction ) );
+                    netMan.setInputPrediction ( InputPrediction::Enum ( InputPrediction::HoldLast + prediction ) );
+                }
+
                 // This will log in the previous appDir folder it not the same
                 LOG ( "appDir='%s'", ProcessManager::appDir );
 
@@ -1638,6 +2010,11 @@ struct DllMain
 
                 isSinglePlayer = clientMode.isSinglePlayer();
 
+                if ( options[Options::MaxSpectators] )
+                    maxSpectators = lexical_cast<uint32_t> ( options.arg ( Options::MaxSpectators ) );
+                else
+                    maxSpectators = ( clientMode.isSpectate() ? MAX_SPECTATORS : MAX_ROOT_SPECTATORS );
+
                 LOG ( "%s: flags={ %s }", clientMode, clientMode.flagString() );
                 break;
 
@@ -1896,7 +2273,7 @@ struct DllMain
 
     // Constructor
     DllMain()
-        : SpectatorManager ( &netMan, &procMan )
+        : SpectatorManager ( &netMan, &procMan, &rollMan )
         , worldTimerMoniter ( this, Variable::WorldTime, *CC_WORLD_TIMER_ADDR )
     {
         // Timer and controller initialization is not done here because of threading issues
@@ -1950,8 +2327,15 @@ private:
         LOG ( "Failed to save: %s", file );
     }
 
-    const IpAddrPort& getRandomRedirectAddress() const
+    const IpAddrPort& getRedirectAddress() const
     {
+        // Redirect to the shallowest free slot in the spectator tree
+        const IpAddrPort& freeAddr = getFreeSpectatorAddress ( clientServerAddr, clientSubtree );
+
+        if ( ! freeAddr.empty() )
+            return freeAddr;
+
+        // The spectator tree is full, or hasn't been reported yet
         size_t r = rand() % ( 1 + numSpectators() );
 
         if ( r == 0 && !clientServerAddr.empty() )
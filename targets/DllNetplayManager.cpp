@@ -3,6 +3,7 @@
 #include "ProcessManager.hpp"
 #include "Exceptions.hpp"
 #include "CharacterSelect.hpp"
+#include "DllRollbackStats.hpp"
 
 #include <algorithm>
 #include <cmath>
@@ -125,6 +126,9 @@ uint16_t NetplayManager::getSkippableInput ( uint8_t player )
 
 uint16_t NetplayManager::getInGameInput ( uint8_t player )
 {
+    if ( player == _remotePlayer && isInRollback() )
+        predictRemoteInputs();
+
     uint16_t input = getRawInput ( player );
 
     // Disable pausing in netplay versus mode. Also only allow start button in versus after holding it for a duration.
@@ -427,70 +431,91 @@ uint16_t NetplayManager::getMenuNavInput()
     return 0;
 }
 
-bool NetplayManager::hasUpDownInHistory ( uint8_t player, uint32_t start, uint32_t end ) const
+const InputHistory& NetplayManager::getInputHistory ( uint8_t player ) const
 {
-    for ( size_t i = start; i < end; ++i )
+    ASSERT ( player == 1 || player == 2 );
+
+    InputHistory& history = _history[player - 1];
+
+    if ( _historyIndex != getIndex() )
     {
-        if ( i > getFrame() )
-            break;
+        _history[0].clear();
+        _history[1].clear();
+        _historyIndex = getIndex();
+    }
 
-        if ( player == 0 )
-        {
-            const uint16_t p1dir = 0xF & getRawInput ( 1, getFrame() - i );
+    // Only the newest frames are kept, so don't bother adding any older frames
+    uint32_t frame = history.getEndFrame();
 
-            const uint16_t p2dir = 0xF & getRawInput ( 2, getFrame() - i );
+    if ( getFrame() >= INPUT_HISTORY_SIZE )
+        frame = max ( frame, getFrame() + 1 - INPUT_HISTORY_SIZE );
 
-            if ( ( p1dir == 2 ) || ( p1dir == 8 ) || ( p2dir == 2 ) || ( p2dir == 8 ) )
-                return true;
-        }
-        else
-        {
-            ASSERT ( player == 1 || player == 2 );
+    for ( ; frame <= getFrame(); ++frame )
+        history.set ( frame, getRawInput ( player, frame ) );
 
-            const uint16_t dir = 0xF & getRawInput ( player, getFrame() - i );
+    return history;
+}
 
-            if ( ( dir == 2 ) || ( dir == 8 ) )
-                return true;
-        }
-    }
+void NetplayManager::invalidateHistory ( uint8_t player, uint32_t index, uint32_t frame )
+{
+    if ( index == _historyIndex )
+        _history[player - 1].invalidate ( frame );
+}
+
+bool NetplayManager::getHistoryRange ( uint32_t start, uint32_t end, uint32_t& first, uint32_t& last ) const
+{
+    if ( start >= end || start > getFrame() )
+        return false;
 
-    return false;
+    first = ( end > getFrame() ? 0 : getFrame() + 1 - end );
+    last = getFrame() + 1 - start;
+    return true;
 }
 
-bool NetplayManager::hasButtonInHistory ( uint8_t player, uint16_t button, uint32_t start, uint32_t end ) const
+bool NetplayManager::hasUpDownInHistory ( uint8_t player, uint32_t start, uint32_t end ) const
 {
+    if ( player == 0 )
+        return hasUpDownInHistory ( 1, start, end ) || hasUpDownInHistory ( 2, start, end );
+
     ASSERT ( player == 1 || player == 2 );
 
-    for ( size_t i = start; i < end; ++i )
-    {
-        if ( i > getFrame() )
-            break;
+    uint32_t first, last;
 
-        const uint16_t buttons = getRawInput ( player, getFrame() - i ) >> 4;
+    if ( ! getHistoryRange ( start, end, first, last ) )
+        return false;
 
-        if ( buttons & button )
-            return true;
-    }
+    const uint32_t upDown = InputHistory::getDirectionChannel ( 2 ) | InputHistory::getDirectionChannel ( 8 );
 
-    return false;
+    return getInputHistory ( player ).any ( upDown, first, last );
+}
+
+bool NetplayManager::hasButtonInHistory ( uint8_t player, uint16_t button, uint32_t start, uint32_t end ) const
+{
+    ASSERT ( player == 1 || player == 2 );
+
+    uint32_t first, last;
+
+    if ( ! getHistoryRange ( start, end, first, last ) )
+        return false;
+
+    return getInputHistory ( player ).any ( InputHistory::getButtonChannels ( button ), first, last );
 }
 
 bool NetplayManager::heldButtonInHistory ( uint8_t player, uint16_t button, uint32_t start, uint32_t end ) const
 {
     ASSERT ( player == 1 || player == 2 );
 
-    for ( size_t i = start; i < end; ++i )
-    {
-        if ( i > getFrame() )
-            return false;
+    if ( start >= end )
+        return true;
 
-        const uint16_t buttons = getRawInput ( player, getFrame() - i ) >> 4;
+    // Not held if the range starts before the first frame
+    if ( end > getFrame() + 1 )
+        return false;
 
-        if ( ! ( buttons & button ) )
-            return false;
-    }
+    uint32_t first, last;
+    getHistoryRange ( start, end, first, last );
 
-    return true;
+    return getInputHistory ( player ).all ( InputHistory::getButtonChannels ( button ), first, last );
 }
 
 void NetplayManager::setRemotePlayer ( uint8_t player )
@@ -550,12 +575,23 @@ void NetplayManager::setState ( NetplayState state )
         if ( state == NetplayState::CharaSelect )
             _spectateStartIndex = getIndex();
 
+        // Entering InGame
+        if ( state == NetplayState::InGame )
+        {
+            _localFrameAdvantage.reset();
+            _remoteFrameAdvantage = 0;
+        }
+
         // Entering Loading
         if ( state == NetplayState::Loading )
         {
             _spectateStartIndex = getIndex();
 
-            const uint32_t newStartIndex = min ( getBufferedPreserveStartIndex(), getIndex() );
+            uint32_t newStartIndex = min ( getBufferedPreserveStartIndex(), getIndex() );
+
+            // Bound the number of indices preserved for spectators that have fallen too far behind
+            if ( getIndex() > maxPreservedIndices )
+                newStartIndex = max ( newStartIndex, getIndex() - maxPreservedIndices );
 
             if ( newStartIndex > _startIndex )
             {
@@ -661,17 +697,21 @@ void NetplayManager::setInput ( uint8_t player, uint16_t input )
     ASSERT ( player == 1 || player == 2 );
     ASSERT ( getIndex() >= _startIndex );
 
+    uint32_t frame;
+
     if ( isInRollback() ) {
-        _inputs[player - 1].set ( getIndex() - _startIndex, getFrame() + config.rollbackDelay, input );
+        frame = getFrame() + config.rollbackDelay;
     } else if ( _state == NetplayState::RetryMenu ) {
-        _inputs[player - 1].set ( getIndex() - _startIndex, getFrame(), input );
+        frame = getFrame();
     } else if ( config.mode.isOffline() && isSplitDelay() ) {
-        _inputs[player - 1].set ( getIndex() - _startIndex,
-                                  getFrame() + (player == 1 ? config.delay : config.rollbackDelay),
-                                  input );
+        frame = getFrame() + (player == 1 ? config.delay : config.rollbackDelay);
     } else {
-        _inputs[player - 1].set ( getIndex() - _startIndex, getFrame() + config.delay, input );
+        frame = getFrame() + config.delay;
     }
+
+    _inputs[player - 1].set ( getIndex() - _startIndex, frame, input );
+
+    invalidateHistory ( player, getIndex(), frame );
 }
 
 void NetplayManager::assignInput ( uint8_t player, uint16_t input, uint32_t frame )
@@ -685,6 +725,49 @@ void NetplayManager::assignInput ( uint8_t player, uint16_t input, IndexedFrame
     ASSERT ( _indexedFrame.parts.index >= _startIndex );
 
     _inputs[player - 1].assign ( _indexedFrame.parts.index - _startIndex, _indexedFrame.parts.frame, input );
+
+    invalidateHistory ( player, _indexedFrame.parts.index, _indexedFrame.parts.frame );
+}
+
+void NetplayManager::updateFrameAdvantage()
+{
+    if ( getIndex() == getRemoteIndex() )
+        _localFrameAdvantage.set ( getRemoteFrameDelta() );
+}
+
+double NetplayManager::getFramesAhead() const
+{
+    if ( ! _localFrameAdvantage.full() )
+        return 0;
+
+    return ( _localFrameAdvantage.get() - _remoteFrameAdvantage ) / 2;
+}
+
+double NetplayManager::getInputLatency() const
+{
+    if ( ! _localFrameAdvantage.full() || getIndex() != getRemoteIndex() )
+        return -1;
+
+    // Both frame advantages include the latency minus the delay, and the offset between the sides with opposite signs
+    return getRemoteFrameDelta() + ( _remoteFrameAdvantage - _localFrameAdvantage.get() ) / 2 + config.delay;
+}
+
+void NetplayManager::predictRemoteInputs()
+{
+    InputsContainer<uint16_t>& inputs = _inputs[_remotePlayer - 1];
+    const uint32_t index = getIndex() - _startIndex;
+
+    // Only predict after the last known input of the current index
+    if ( index + 1 != inputs.getEndIndex() || inputs.empty ( index ) )
+        return;
+
+    const uint32_t endFrame = inputs.getEndFrame ( index );
+    const uint16_t last = inputs.get ( index, endFrame - 1 );
+
+    invalidateHistory ( _remotePlayer, getIndex(), inputs.getPredictedEndFrame() );
+
+    for ( uint32_t frame = inputs.getPredictedEndFrame(); frame <= getFrame(); ++frame )
+        inputs.predict ( index, frame, _predictor->predict ( last, frame + 1 - endFrame ) );
 }
 
 MsgPtr NetplayManager::getInputs ( uint8_t player ) const
@@ -697,9 +780,36 @@ MsgPtr NetplayManager::getInputs ( uint8_t player ) const
 
     ASSERT ( playerInputs->getIndex() >= _startIndex );
 
+    // Only send the inputs the remote side doesn't have yet, plus a few in case the newest ones are lost.
+    // If there are more than NUM_INPUTS, the oldest ones are sent first, since the inputs must be contiguous.
+    uint32_t startFrame = 0;
+
+    if ( _remoteAckedEndFrame.parts.index == playerInputs->getIndex() )
+    {
+        startFrame = min ( _remoteAckedEndFrame.parts.frame,
+                           playerInputs->getEndFrame() > MIN_REDUNDANT_INPUTS
+                           ? playerInputs->getEndFrame() - MIN_REDUNDANT_INPUTS : 0 );
+    }
+
+    if ( startFrame + NUM_INPUTS < playerInputs->getEndFrame() )
+        playerInputs->indexedFrame.parts.frame = startFrame + NUM_INPUTS - 1;
+
+    playerInputs->setStartFrame ( startFrame );
+
+    const uint8_t otherPlayer = 3 - player;
+    playerInputs->ackedEndFrame = { _inputs[otherPlayer - 1].getEndFrame ( getIndex() - _startIndex ), getIndex() };
+
     _inputs[player - 1].get ( playerInputs->getIndex() - _startIndex, playerInputs->getStartFrame(),
                               &playerInputs->inputs[0], playerInputs->size() );
 
+    if ( _localHashFrame.parts.index == playerInputs->getIndex() )
+    {
+        playerInputs->hashFrame = _localHashFrame.parts.frame;
+        playerInputs->stateHash = _localStateHash;
+    }
+
+    playerInputs->frameAdvantage = int8_t ( lround ( clamped ( _localFrameAdvantage.get(), -100.0, 100.0 ) ) );
+
     return MsgPtr ( playerInputs );
 }
 
@@ -714,9 +824,38 @@ void NetplayManager::setInputs ( uint8_t player, const PlayerInputs& playerInput
     ASSERT ( playerInputs.getIndex() >= _startIndex );
 
     const uint32_t checkStartingFromIndex = ( isInRollback() ? getIndex() - _startIndex : UINT_MAX );
+    const uint32_t index = playerInputs.getIndex() - _startIndex;
+    const uint32_t endFrame = _inputs[player - 1].getEndFrame ( index );
 
-    _inputs[player - 1].set ( playerInputs.getIndex() - _startIndex, playerInputs.getStartFrame(),
+    _inputs[player - 1].set ( index, playerInputs.getStartFrame(),
                               &playerInputs.inputs[0], playerInputs.size(), checkStartingFromIndex );
+
+    // Only the inputs after the last known input can change
+    invalidateHistory ( player, playerInputs.getIndex(), endFrame );
+
+    // Learn from the new in-game inputs
+    if ( isInGame() && playerInputs.getIndex() == getIndex() )
+    {
+        const InputsContainer<uint16_t>& inputs = _inputs[player - 1];
+
+        for ( uint32_t frame = max ( endFrame, 1u ); frame < inputs.getEndFrame ( index ); ++frame )
+            _predictor->update ( inputs.get ( index, frame - 1 ), inputs.get ( index, frame ) );
+    }
+
+    if ( playerInputs.getIndex() == getIndex() )
+        _remoteFrameAdvantage = playerInputs.frameAdvantage;
+
+    // Messages can arrive out of order, so only keep the newest ack
+    if ( playerInputs.ackedEndFrame.value > _remoteAckedEndFrame.value )
+        _remoteAckedEndFrame = playerInputs.ackedEndFrame;
+
+    if ( playerInputs.hashFrame != UINT_MAX
+            && playerInputs.getIndex() == getIndex()
+            && _remoteHashFrame.value == MaxIndexedFrame.value )
+    {
+        _remoteHashFrame = { playerInputs.hashFrame, playerInputs.getIndex() };
+        _remoteStateHash = playerInputs.stateHash;
+    }
 }
 
 MsgPtr NetplayManager::getBothInputs ( IndexedFrame& pos ) const
@@ -802,6 +941,9 @@ void NetplayManager::setBothInputs ( const BothInputs& bothInputs )
 
     _inputs[1].set ( bothInputs.getIndex() - _startIndex, bothInputs.getStartFrame(),
                      &bothInputs.inputs[1][0], bothInputs.size() );
+
+    invalidateHistory ( 1, bothInputs.getIndex(), bothInputs.getStartFrame() );
+    invalidateHistory ( 2, bothInputs.getIndex(), bothInputs.getStartFrame() );
 }
 
 bool NetplayManager::isRemoteInputReady() const
@@ -959,6 +1101,26 @@ void NetplayManager::clearLastChangedFrame()
     _inputs[_remotePlayer - 1].clearLastChangedFrame();
 }
 
+IndexedFrame NetplayManager::getConfirmedFrame() const
+{
+    if ( _inputs[_remotePlayer - 1].empty() || getRemoteIndex() < getIndex() )
+        return MaxIndexedFrame;
+
+    // All remote inputs for this index are known if the remote has moved on to a later index
+    IndexedFrame confirmed = _indexedFrame;
+
+    if ( getRemoteIndex() == getIndex() && getRemoteFrame() < getFrame() )
+        confirmed.parts.frame = getRemoteFrame();
+
+    // Any state after a changed input will be rolled back
+    const IndexedFrame lastChangedFrame = getLastChangedFrame();
+
+    if ( lastChangedFrame.value < confirmed.value )
+        confirmed = lastChangedFrame;
+
+    return confirmed;
+}
+
 void NetplayManager::setRemoteIndex ( uint32_t remoteIndex )
 {
     if ( remoteIndex < _startIndex )
@@ -1025,6 +1187,10 @@ void NetplayManager::exportResults()
     }
     resFile << buf << endl;
     resFile.close();
+
+    // Rollback telemetry for the same match
+    RollbackStats::get().exportResults ( "rollback_stats.csv", now );
+    RollbackStats::get().clear();
 }
 
 string NetplayManager::sanitizePlayerName( string name )
@@ -2,12 +2,19 @@
 
 #include "Messages.hpp"
 #include "InputsContainer.hpp"
+#include "InputPredictor.hpp"
+#include "InputHistory.hpp"
 #include "NetplayStates.hpp"
+#include "RollingAverage.hpp"
 
 #include <vector>
 #include <climits>
 
 
+// Number of frames the frame advantage is averaged over
+#define FRAME_ADVANTAGE_WINDOW ( 40 )
+
+
 // Class that manages netplay state and inputs
 class NetplayManager
 {
@@ -22,6 +29,9 @@ public:
     // Preserve input/RngState/MenuIndex starting from this index
     uint32_t preserveStartIndex = UINT_MAX;
 
+    // Maximum number of older indices preserved for spectators, spectators that fall further behind are dropped
+    uint32_t maxPreservedIndices = 64;
+
     // The number of frames it takes to register a held start button input
     uint32_t heldStartDuration = 0;
 
@@ -51,11 +61,25 @@ public:
         return 0;
     }
 
+    // Sample the local frame advantage for the current frame, ie how far ahead of the received remote inputs we are
+    void updateFrameAdvantage();
+
+    // Get the number of frames we are ahead of the remote side, based on the local and remote frame advantages.
+    // The input latency is included in both advantages, so it cancels out. Returns 0 until enough samples are taken.
+    double getFramesAhead() const;
+
+    // Get the one-way input latency in frames for the current frame. The clock offset between the sides is removed
+    // using the average local and remote frame advantages. Returns -1 until enough samples are taken.
+    double getInputLatency() const;
+
     // Get the index for spectators to start inputs on.
     // During CharaSelect state, this is the beginning of the current CharaSelect state.
     // During any other state, this is the beginning of the current game's Loading state.
     uint32_t getSpectateStartIndex() const { return _spectateStartIndex; }
 
+    // Get the oldest index that still has inputs
+    uint32_t getStartIndex() const { return _startIndex; }
+
     // Get / clear the last changed frame (for rollback)
     IndexedFrame getLastChangedFrame() const;
     void clearLastChangedFrame();
@@ -81,6 +105,29 @@ public:
     MsgPtr getInputs ( uint8_t player ) const;
     void setInputs ( uint8_t player, const PlayerInputs& playerInputs );
 
+    // Get the input history of the given player for the current index, up to and including the current frame
+    const InputHistory& getInputHistory ( uint8_t player ) const;
+
+    // Set how remote inputs that haven't been received yet are predicted during rollback
+    void setInputPrediction ( InputPrediction type ) { _predictor = InputPredictor::create ( type ); }
+
+    // Set the hash of the newest confirmed local game state, which is sent along with the local inputs
+    void setLocalStateHash ( IndexedFrame indexedFrame, uint32_t hash )
+    {
+        _localHashFrame = indexedFrame;
+        _localStateHash = hash;
+    }
+
+    // Get / clear the remote game state hash received along with the remote inputs.
+    // Newer remote hashes are ignored until the current one is cleared. Returns MaxIndexedFrame if there isn't one.
+    IndexedFrame getRemoteHashFrame() const { return _remoteHashFrame; }
+    uint32_t getRemoteStateHash() const { return _remoteStateHash; }
+    void clearRemoteStateHash() { _remoteHashFrame = MaxIndexedFrame; }
+
+    // Get the newest frame where the local game state is final, ie it can't be changed by a rollback anymore.
+    // Returns MaxIndexedFrame if no frames in the current index are final yet.
+    IndexedFrame getConfirmedFrame() const;
+
     // Get inputs both players. May return null if not enough inputs are ready for the given pos.
     // Otherwise this increments the given pos by at most NUM_INPUTS if returning non-null.
     MsgPtr getBothInputs ( IndexedFrame& pos ) const;
@@ -179,6 +226,15 @@ private:
     // Mapping: player -> index offset -> frame -> input
     std::array<InputsContainer<uint16_t>, 2> _inputs;
 
+    // Input history of each player for the current frame, updated when checked, and invalidated when inputs change
+    mutable std::array<InputHistory, 2> _history;
+
+    // Index of the input history
+    mutable uint32_t _historyIndex = UINT_MAX;
+
+    // Predicts the remote inputs that haven't been received yet
+    std::shared_ptr<InputPredictor> _predictor = InputPredictor::create ( InputPrediction::HoldLast );
+
     // Mapping: index offset -> RngState (can be null)
     std::vector<MsgPtr> _rngStates;
 
@@ -194,6 +250,21 @@ private:
     // Separate delays for p1/p2
     bool _splitDelay = true;
 
+    // Newest confirmed local game state hash
+    IndexedFrame _localHashFrame = MaxIndexedFrame;
+    uint32_t _localStateHash = 0;
+
+    // Average local frame advantage, and the newest average remote frame advantage
+    RollingAverage<double, FRAME_ADVANTAGE_WINDOW> _localFrameAdvantage;
+    int8_t _remoteFrameAdvantage = 0;
+
+    // End of the local inputs that the remote side has acknowledged
+    IndexedFrame _remoteAckedEndFrame = {{ 0, 0 }};
+
+    // Remote game state hash that hasn't been checked yet
+    IndexedFrame _remoteHashFrame = MaxIndexedFrame;
+    uint32_t _remoteStateHash = 0;
+
     // Get the input for the specific NetplayState
     uint16_t getPreInitialInput ( uint8_t player );
     uint16_t getInitialInput ( uint8_t player );
@@ -207,6 +278,16 @@ private:
     // Get the input needed to navigate the menu
     uint16_t getMenuNavInput();
 
+    // Predict the remote inputs up to the current frame
+    void predictRemoteInputs();
+
+    // Invalidate the input history of the given player starting from index:frame
+    void invalidateHistory ( uint8_t player, uint32_t index, uint32_t frame );
+
+    // Get the frames [first, last) for a range of frames that counts backwards from the current frame.
+    // Returns false if the range is empty.
+    bool getHistoryRange ( uint32_t start, uint32_t end, uint32_t& first, uint32_t& last ) const;
+
     // Detect if a key has been pressed / held by either player in the input history.
     // The start and end indicies begin from the current frame and count backwards.
     bool hasUpDownInHistory ( uint8_t player, uint32_t start, uint32_t end ) const;
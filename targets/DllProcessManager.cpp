@@ -65,11 +65,31 @@ void ProcessManager::setRngState ( const RngState& rngState )
 
 void ProcessManager::connectPipe()
 {
-    LOG ( "Listening on IPC socket" );
+    _processId = GetCurrentProcessId();
+
+    LOG ( "Creating IPC shared memory pipe" );
+
+    _ipcPipe = SharedMemoryPipe::create ( this, getPipeName ( _processId ) );
+
+    // The port sent to the EXE is 0 when using the shared memory pipe
+    uint16_t ipcPort = 0;
+
+    if ( _ipcPipe )
+    {
+        LOG ( "ipcPipe=%08x", _ipcPipe.get() );
 
-    _ipcSocket = TcpSocket::listen ( this, 0 );
+        // This is buffered in the pipe until the EXE opens it
+        _ipcPipe->send ( new IpcConnected() );
+    }
+    else
+    {
+        LOG ( "Listening on IPC socket" );
+
+        _ipcSocket = TcpSocket::listen ( this, 0 );
+        ipcPort = _ipcSocket->address.port;
 
-    LOG ( "ipcSocket=%08x", _ipcSocket.get() );
+        LOG ( "ipcSocket=%08x", _ipcSocket.get() );
+    }
 
     LOG ( "Creating pipe" );
 
@@ -89,13 +109,11 @@ void ProcessManager::connectPipe()
 
     DWORD bytes;
 
-    if ( ! WriteFile ( _pipe, & ( _ipcSocket->address.port ), sizeof ( _ipcSocket->address.port ), &bytes, 0 ) )
+    if ( ! WriteFile ( _pipe, &ipcPort, sizeof ( ipcPort ), &bytes, 0 ) )
         THROW_WIN_EXCEPTION ( GetLastError(), "WriteFile failed", ERROR_PIPE_RW );
 
-    if ( bytes != sizeof ( _ipcSocket->address.port ) )
-        THROW_EXCEPTION ( "wrote %d bytes, expected %d", ERROR_PIPE_RW, bytes, sizeof ( _ipcSocket->address.port ) );
-
-    _processId = GetCurrentProcessId();
+    if ( bytes != sizeof ( ipcPort ) )
+        THROW_EXCEPTION ( "wrote %d bytes, expected %d", ERROR_PIPE_RW, bytes, sizeof ( ipcPort ) );
 
     LOG ( "processId=%08x", _processId );
 
@@ -2,9 +2,13 @@
 #include "MemDump.hpp"
 #include "DllAsmHacks.hpp"
 #include "ErrorStringsExt.hpp"
+#include "Algorithms.hpp"
+#include "DllRollbackStats.hpp"
+#include "Compression.hpp"
 
 #include <utility>
 #include <algorithm>
+#include <fstream>
 
 using namespace std;
 
@@ -16,234 +20,817 @@ extern const unsigned char binary_res_rollback_bin_end;
 // Deserialized rollback memory data
 static MemDumpList allAddrs;
 
-template<typename T>
-static inline void deleteArray ( T *ptr ) { delete[] ptr; }
+static size_t getRollbackDataSize()
+{
+    return ( ( char * ) &binary_res_rollback_bin_end ) - ( char * ) &binary_res_rollback_bin_start;
+}
+
+static void loadRollbackData()
+{
+    if ( allAddrs.empty() )
+        allAddrs.load ( ( char * ) &binary_res_rollback_bin_start, getRollbackDataSize() );
+
+    if ( allAddrs.empty() )
+        THROW_EXCEPTION ( "Failed to load rollback data!", ERROR_BAD_ROLLBACK_DATA );
+}
+
+// Memory budget for the snapshot store, in units of complete game states.
+// Unchanged blocks are shared and changed blocks are delta compressed, so this normally holds NUM_ROLLBACK_STATES
+// game states, but it still guarantees enough room for the maximum rollback if every block changes every frame.
+#ifdef RELEASE
+#define ROLLBACK_BUDGET_STATES ( 2 * ( MAX_ROLLBACK + 1 ) )
+#else
+#define ROLLBACK_BUDGET_STATES ( NUM_ROLLBACK_STATES )
+#endif
+
+// Number of frames between updates of the save interval
+#define SAVE_INTERVAL_UPDATE_FRAMES ( 60 )
+
+// Weight of each new sample in the moving averages of the cost model
+#define COST_SAMPLE_WEIGHT ( 0.1 )
+
+// Fraction of rollbacks that must stay within MAX_ROLLBACK re-run frames, including the extra frames from the interval
+#define ROLLBACK_DEPTH_PERCENTILE ( 0.95 )
+
+// Compression level of the keyframes for spectators
+#define KEYFRAME_COMPRESSION ( 1 )
+
+
+// The SFX arrays are scanned one word at a time, so any sounds can be found quickly
+static_assert ( CC_SFX_ARRAY_LEN % sizeof ( uint32_t ) == 0, "CC_SFX_ARRAY_LEN must be a multiple of 4" );
+
+static inline uint32_t loadSfxWord ( const uint8_t *bytes )
+{
+    uint32_t word;
+    memcpy ( &word, bytes, sizeof ( word ) );
+    return word;
+}
+
+// Pack the SFX flags where ( byte & mask ) is non-zero into a bitset. Returns false if there are none.
+static bool packSfx ( const uint8_t *bytes, uint8_t mask, uint32_t *bits, size_t numWords )
+{
+    const uint32_t wordMask = 0x01010101u * mask;
+
+    bool any = false;
+
+    memset ( bits, 0, numWords * sizeof ( uint32_t ) );
+
+    for ( size_t i = 0; i < CC_SFX_ARRAY_LEN; i += sizeof ( uint32_t ) )
+    {
+        if ( ! ( loadSfxWord ( &bytes[i] ) & wordMask ) )
+            continue;
+
+        for ( size_t j = i; j < i + sizeof ( uint32_t ); ++j )
+        {
+            if ( bytes[j] & mask )
+                bits[j / 32] |= ( 1u << ( j % 32 ) );
+        }
+
+        any = true;
+    }
+
+    return any;
+}
+
+static void addCostSample ( double& average, double sample )
+{
+    if ( average == 0 )
+        average = sample;
+    else
+        average += COST_SAMPLE_WEIGHT * ( sample - average );
+}
 
 
-void DllRollbackManager::GameState::save()
+void DllRollbackManager::saveRawBytes ( GameState& state )
 {
-    ASSERT ( rawBytes != 0 );
+    ASSERT ( _scratchImage.size() == allAddrs.totalSize );
+
+    allAddrs.saveDump ( &_scratchImage[0] );
+
+    // Hash each region for desync detection
+    allAddrs.hashRegions ( &_scratchImage[0], &state.regionHashes[0] );
+    state.stateHash = hashBytes ( &state.regionHashes[0], state.regionHashes.size() * sizeof ( uint32_t ) );
+
+    // Save relative to the newest game state, which is usually the previous frame
+    const size_t baseSlot = ( _statesCount ? getState ( _statesCount - 1 ).slot : SnapshotStore::NoSlot );
+
+    if ( ! asyncSave )
+    {
+        _snapshots.save ( state.slot, &_scratchImage[0], baseSlot );
+        return;
+    }
 
-    char *dump = rawBytes;
+    // Hand off to the worker thread, the scratch image isn't touched until the save finishes
+    LOCK ( _saveMutex );
 
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.saveDump ( dump );
+    ASSERT ( _pendingSlot == SnapshotStore::NoSlot );
 
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
+    _pendingSlot = state.slot;
+    _pendingBaseSlot = baseSlot;
+    _saveCond.signal();
 }
 
-void DllRollbackManager::GameState::load()
+void DllRollbackManager::loadRawBytes ( const GameState& state )
 {
-    fesetenv(&fp_env);
+    fesetenv ( &state.fp_env );
 
-    ASSERT ( rawBytes != 0 );
+    ASSERT ( _scratchImage.size() == allAddrs.totalSize );
 
-    const char *dump = rawBytes;
+    // The needed state may still be in flight
+    waitForSave();
 
-    for ( const MemDump& mem : allAddrs.addrs )
-        mem.loadDump ( dump );
+    _snapshots.load ( state.slot, &_scratchImage[0] );
 
-    ASSERT ( dump == rawBytes + allAddrs.totalSize );
+    allAddrs.loadDump ( &_scratchImage[0] );
+}
+
+void DllRollbackManager::SaveThread::run()
+{
+    for ( ;; )
+    {
+        size_t slot, baseSlot;
+
+        {
+            Lock lock ( _rollMan._saveMutex );
+
+            while ( _rollMan._pendingSlot == SnapshotStore::NoSlot && ! _rollMan._stopSaveThread )
+                _rollMan._saveCond.wait ( _rollMan._saveMutex );
+
+            if ( _rollMan._pendingSlot == SnapshotStore::NoSlot )
+                return;
+
+            slot = _rollMan._pendingSlot;
+            baseSlot = _rollMan._pendingBaseSlot;
+        }
+
+        // The game thread doesn't access the snapshot store or the scratch image while a save is in flight
+        _rollMan._snapshots.save ( slot, &_rollMan._scratchImage[0], baseSlot );
+
+        Lock lock ( _rollMan._saveMutex );
+        _rollMan._pendingSlot = SnapshotStore::NoSlot;
+        _rollMan._saveCond.broadcast();
+    }
+}
+
+void DllRollbackManager::waitForSave()
+{
+    if ( ! asyncSave )
+        return;
+
+    LOCK ( _saveMutex );
+
+    while ( _pendingSlot != SnapshotStore::NoSlot )
+        _saveCond.wait ( _saveMutex );
+}
+
+void DllRollbackManager::stopSaveThread()
+{
+    {
+        LOCK ( _saveMutex );
+        _stopSaveThread = true;
+        _saveCond.broadcast();
+    }
+
+    _saveThread.join();
+
+    _stopSaveThread = false;
 }
 
 void DllRollbackManager::allocateStates()
 {
-    if ( allAddrs.empty() )
+    stopSaveThread();
+
+    loadRollbackData();
+
+    // One extra slot for the pinned state
+    if ( ! _snapshots.isInitialized() )
     {
-        const size_t size = ( ( char * ) &binary_res_rollback_bin_end ) - ( char * ) &binary_res_rollback_bin_start;
-        allAddrs.load ( ( char * ) &binary_res_rollback_bin_start, size );
+        _snapshots.initialize ( allAddrs.totalSize, NUM_ROLLBACK_STATES + 1,
+                                ROLLBACK_BUDGET_STATES * allAddrs.totalSize );
+        _scratchImage.resize ( allAddrs.totalSize );
     }
 
-    if ( allAddrs.empty() )
-        THROW_EXCEPTION ( "Failed to load rollback data!", ERROR_BAD_ROLLBACK_DATA );
+    _snapshots.clear();
 
-    if ( ! _memoryPool )
-        _memoryPool.reset ( new char[NUM_ROLLBACK_STATES * allAddrs.totalSize], deleteArray<char> );
+    if ( asyncSave )
+        _saveThread.start();
 
-    for ( size_t i = 0; i < NUM_ROLLBACK_STATES; ++i )
-        _freeStack.push ( i * allAddrs.totalSize );
+    for ( size_t i = 0; i < _states.size(); ++i )
+    {
+        _states[i].slot = i;
+        _states[i].regionHashes.resize ( allAddrs.addrs.size() );
+    }
+
+    _pinnedState.regionHashes.resize ( allAddrs.addrs.size() );
+
+    _statesBegin = _statesCount = 0;
+
+    _pinnedState.slot = NUM_ROLLBACK_STATES;
+    _hasPinnedState = false;
 
-    _statesList.clear();
+    for ( SfxHistory& sfxHistory : _sfxHistory )
+    {
+        sfxHistory.bits.fill ( 0 );
+        sfxHistory.any = false;
+    }
 
-    for ( auto& sfxArray : _sfxHistory )
-        memset ( &sfxArray[0], 0, CC_SFX_ARRAY_LEN );
+    // The measured costs carry over, but the rollback statistics start fresh each time
+    _saveInterval = 1;
+    _intervalFrames = _intervalRollbacks = 0;
+    _rollbackDepths.fill ( 0 );
+    _rerunFrames = 0;
 }
 
 void DllRollbackManager::deallocateStates()
 {
-    _memoryPool.reset();
+    stopSaveThread();
+
+    _snapshots.deinitialize();
 
-    while ( ! _freeStack.empty() )
-        _freeStack.pop();
+    vector<char>().swap ( _scratchImage );
 
-    _statesList.clear();
+    _statesBegin = _statesCount = 0;
+    _hasPinnedState = false;
 }
 
-void DllRollbackManager::saveState ( const NetplayManager& netMan )
+size_t DllRollbackManager::findState ( IndexedFrame indexedFrame ) const
 {
-    if ( _freeStack.empty() )
+    if ( _statesCount == 0 || getState ( 0 ).indexedFrame.value > indexedFrame.value )
+        return NoState;
+
+    const IndexedFrame newest = getState ( _statesCount - 1 ).indexedFrame;
+
+    if ( newest.value <= indexedFrame.value )
+        return _statesCount - 1;
+
+    // States are normally saved every frame, so the position can be computed directly from the frame difference
+    if ( newest.parts.index == indexedFrame.parts.index && newest.parts.frame - indexedFrame.parts.frame < _statesCount )
     {
-        ASSERT ( _statesList.empty() == false );
+        const size_t i = _statesCount - 1 - ( newest.parts.frame - indexedFrame.parts.frame );
 
-        if ( _statesList.front().indexedFrame.parts.frame <= netMan.getRemoteFrame() )
+        if ( getState ( i ).indexedFrame.value <= indexedFrame.value
+                && getState ( i + 1 ).indexedFrame.value > indexedFrame.value )
         {
-            auto it = _statesList.begin();
-            ++it;
-            _freeStack.push ( it->rawBytes - _memoryPool.get() );
-            _statesList.erase ( it );
+            return i;
         }
+    }
+
+    // Otherwise binary search for the last state at or before the given frame
+    size_t lo = 0, hi = _statesCount - 1;
+
+    while ( lo < hi )
+    {
+        const size_t mid = ( lo + hi + 1 ) / 2;
+
+        if ( getState ( mid ).indexedFrame.value <= indexedFrame.value )
+            lo = mid;
         else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+void DllRollbackManager::evictState ( const NetplayManager& netMan )
+{
+    ASSERT ( _statesCount > 0 );
+
+    GameState& oldest = getState ( 0 );
+
+    // Pin the oldest state if it's at or before the remote frame, since it may still be needed to rollback.
+    // The state is moved by swapping slots, so the ring entry takes over the previous pinned state's slot.
+    if ( oldest.indexedFrame.parts.frame <= netMan.getRemoteFrame() )
+    {
+        if ( _hasPinnedState )
+            _snapshots.release ( _pinnedState.slot );
+
+        swap ( oldest, _pinnedState );
+        _hasPinnedState = true;
+    }
+    else
+    {
+        _snapshots.release ( oldest.slot );
+    }
+
+    _statesBegin = ( _statesBegin + 1 ) % _states.size();
+    --_statesCount;
+}
+
+void DllRollbackManager::saveState ( const NetplayManager& netMan )
+{
+    // Sound effects are recorded every frame, since every frame after the loaded state is re-run
+    SfxHistory& currentSfx = _sfxHistory [ netMan.getFrame() % NUM_ROLLBACK_STATES ];
+    currentSfx.any = packSfx ( AsmHacks::sfxFilterArray, 0xFF, &currentSfx.bits[0], SfxWords );
+
+    _lastSaveFrame = netMan._indexedFrame;
+
+    if ( ++_intervalFrames >= SAVE_INTERVAL_UPDATE_FRAMES )
+        updateSaveInterval();
+
+    // Always save the first frame of each index, then only every _saveInterval frames
+    if ( _statesCount && getState ( _statesCount - 1 ).indexedFrame.parts.index == netMan.getIndex()
+            && netMan.getFrame() % _saveInterval != 0 )
+    {
+        return;
+    }
+
+    // The previous save is normally finished by now
+    waitForSave();
+
+    const uint64_t startTime = RollbackStats::getMicroseconds();
+
+    // Free states until there is a free slot AND enough free blocks for a completely changed state
+    while ( _statesCount == _states.size() || ! _snapshots.canSave() )
+    {
+        // Only give up the pinned state as a last resort
+        if ( _statesCount == 0 )
         {
-            _freeStack.push ( _statesList.front().rawBytes - _memoryPool.get() );
-            _statesList.pop_front();
+            ASSERT ( _hasPinnedState == true );
+
+            _snapshots.release ( _pinnedState.slot );
+            _hasPinnedState = false;
+            continue;
         }
+
+        evictState ( netMan );
     }
 
     std::fenv_t fp_env;
 
     fegetenv(&fp_env);
 
-    GameState state =
-    {
-        netMan._state,
-        netMan._startWorldTime,
-        netMan._indexedFrame,
-        fp_env,
-        _memoryPool.get() + _freeStack.top()
-    };
+    GameState& state = getState ( _statesCount );
 
-    _freeStack.pop();
-    state.save();
-    _statesList.push_back ( state );
+    state.netplayState = netMan._state;
+    state.startWorldTime = netMan._startWorldTime;
+    state.indexedFrame = netMan._indexedFrame;
+    state.fp_env = fp_env;
 
-    uint8_t *currentSfxArray = &_sfxHistory [ netMan.getFrame() % NUM_ROLLBACK_STATES ][0];
-    memcpy ( currentSfxArray, AsmHacks::sfxFilterArray, CC_SFX_ARRAY_LEN );
+    saveRawBytes ( state );
+    ++_statesCount;
+
+    const uint64_t saveTime = RollbackStats::getMicroseconds() - startTime;
+
+    addCostSample ( _avgSaveTime, saveTime );
+    RollbackStats::get().addSaveTime ( saveTime );
 }
 
 bool DllRollbackManager::loadState ( IndexedFrame indexedFrame, NetplayManager& netMan )
 {
-    if ( _statesList.empty() )
+    if ( _statesCount == 0 && ! _hasPinnedState )
     {
         LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
         return false;
     }
 
-    LOG ( "Trying to load state: indexedFrame=%s; _statesList={ %s ... %s }",
-          indexedFrame, _statesList.front().indexedFrame, _statesList.back().indexedFrame );
+    if ( _statesCount )
+    {
+        LOG ( "Trying to load state: indexedFrame=%s; _states={ %s ... %s }",
+              indexedFrame, getState ( 0 ).indexedFrame, getState ( _statesCount - 1 ).indexedFrame );
+    }
+
+    if ( _hasPinnedState )
+        LOG ( "_pinnedState=%s", _pinnedState.indexedFrame );
 
+    const uint64_t startTime = RollbackStats::getMicroseconds();
+
+    // Releasing states touches the snapshot store
+    waitForSave();
+
+    const IndexedFrame origIndexedFrame = netMan.getIndexedFrame();
     const uint32_t origFrame = netMan.getFrame();
 
-    for ( auto it = _statesList.rbegin(); it != _statesList.rend(); ++it )
+    size_t pos = findState ( indexedFrame );
+
+    if ( pos == NoState )
     {
 #ifdef RELEASE
-        if ( ( it->indexedFrame.value <= indexedFrame.value ) || ( & ( *it ) == &_statesList.front() ) )
+        if ( _hasPinnedState )
 #else
-        if ( it->indexedFrame.value <= indexedFrame.value )
+        if ( _hasPinnedState && _pinnedState.indexedFrame.value <= indexedFrame.value )
 #endif
         {
-            LOG ( "Loaded state: indexedFrame=%s", it->indexedFrame );
-
-            // Overwrite the current game state
-            netMan._state = it->netplayState;
-            netMan._startWorldTime = it->startWorldTime;
-            netMan._indexedFrame = it->indexedFrame;
-            it->load();
-            
-            
-            int rbFrames;
-            if (netMan.replayRollbackOn) {
-                // Count the number of frames rolled back
-                rbFrames = _statesList.back().indexedFrame.value - it->indexedFrame.value;
-                //LOG("Rolled back %i frames", rbFrames);
-            }
+            // Move the pinned state back into the ring, replacing every newer state
+            for ( size_t i = 0; i < _statesCount; ++i )
+                _snapshots.release ( getState ( i ).slot );
+
+            swap ( getState ( 0 ), _pinnedState );
+            _hasPinnedState = false;
+            _statesCount = 1;
+            pos = 0;
+        }
+#ifdef RELEASE
+        else
+        {
+            // Load the oldest state
+            pos = 0;
+        }
+#else
+        else
+        {
+            LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
+            return false;
+        }
+#endif
+    }
 
-            // Erase all other states after the current one.
-            // Note: it.base() returns 1 after the position of it, but moving forward.
-            for ( auto jt = it.base(); jt != _statesList.end(); ++jt )
-            {
-                _freeStack.push ( jt->rawBytes - _memoryPool.get() );
-            }
-            
-            if (!netMan.config.mode.isTraining() && netMan.replayRollbackOn) {
-                // Erase one frame of inputs from the game's replay structs for each frame rolled back.
-                for (; rbFrames > 0; rbFrames--) {
-                    if (!*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR) break;
-                    RepRound* curRound = (*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR - 1);
-                    if (!curRound->inputs) break;
-                    // Assumes there are always containers for 4 players in input container table; may not be true
-                    for (int i=0; i<4; i++) {
-                        RepInputContainer* inputs = &(curRound->inputs[i]);
-                        if (!inputs->states) continue;
-                        RepInputState* state = &(inputs->states[inputs->activeIndex]);
-                        if (!state->frameCount) continue;
-                        if (state->frameCount == 1) {
-                            memset(state, 0, sizeof(RepInputState));
-                            inputs->statesEnd -= sizeof(RepInputState);
-                            //LOG("Replay state %i for p%i has frame count 1; decrementing index", inputs->activeIndex, i+1);
-                            inputs->activeIndex--;
-                        } else {
-                            //LOG("Replay state %i for p%i has frame count %i; decrementing count", inputs->activeIndex, i+1, state->frameCount);
-                            state->frameCount--;
-                        }
-                    }
+    const GameState& state = getState ( pos );
+
+    LOG ( "Loaded state: indexedFrame=%s", state.indexedFrame );
+
+    // Overwrite the current game state
+    netMan._state = state.netplayState;
+    netMan._startWorldTime = state.startWorldTime;
+    netMan._indexedFrame = state.indexedFrame;
+    loadRawBytes ( state );
+
+    RollbackStats::get().addLoadTime ( RollbackStats::getMicroseconds() - startTime );
+
+    int rbFrames;
+    if (netMan.replayRollbackOn) {
+        // Count the number of frames rolled back
+        rbFrames = _lastSaveFrame.value - state.indexedFrame.value;
+        //LOG("Rolled back %i frames", rbFrames);
+    }
+
+    // Record the rollback depth, and start timing the re-run
+    _rerunFrames = ( origIndexedFrame.parts.index == state.indexedFrame.parts.index ? origFrame - netMan.getFrame() : 0 );
+    _rerunStartTime = RollbackStats::getMicroseconds();
+
+    if ( origIndexedFrame.parts.index == indexedFrame.parts.index && origFrame >= indexedFrame.parts.frame )
+    {
+        ++_rollbackDepths [ min<uint32_t> ( origFrame - indexedFrame.parts.frame, MAX_ROLLBACK ) ];
+        ++_intervalRollbacks;
+
+        RollbackStats::get().addRollback ( origFrame - indexedFrame.parts.frame, _rerunFrames );
+    }
+
+    // Erase all other states after the current one
+    for ( size_t i = pos + 1; i < _statesCount; ++i )
+        _snapshots.release ( getState ( i ).slot );
+
+    _statesCount = pos + 1;
+
+    if (!netMan.config.mode.isTraining() && netMan.replayRollbackOn) {
+        // Erase one frame of inputs from the game's replay structs for each frame rolled back.
+        for (; rbFrames > 0; rbFrames--) {
+            if (!*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR) break;
+            RepRound* curRound = (*(RepRound**)CC_REPROUND_TBL_ENDPTR_ADDR - 1);
+            if (!curRound->inputs) break;
+            // Assumes there are always containers for 4 players in input container table; may not be true
+            for (int i=0; i<4; i++) {
+                RepInputContainer* inputs = &(curRound->inputs[i]);
+                if (!inputs->states) continue;
+                RepInputState* state = &(inputs->states[inputs->activeIndex]);
+                if (!state->frameCount) continue;
+                if (state->frameCount == 1) {
+                    memset(state, 0, sizeof(RepInputState));
+                    inputs->statesEnd -= sizeof(RepInputState);
+                    //LOG("Replay state %i for p%i has frame count 1; decrementing index", inputs->activeIndex, i+1);
+                    inputs->activeIndex--;
+                } else {
+                    //LOG("Replay state %i for p%i has frame count %i; decrementing count", inputs->activeIndex, i+1, state->frameCount);
+                    state->frameCount--;
                 }
             }
+        }
+    }
 
-            _statesList.erase ( it.base(), _statesList.end() );
+    // Initialize the SFX filter by flagging all played SFX flags in the range (R,S),
+    // where R is the actual reset frame, and S is the original starting frame.
+    // Note: we can skip frame S, because the current SFX filter array is already initialized by frame S.
+    array<uint32_t, SfxWords> played;
+    played.fill ( 0 );
 
-            // Initialize the SFX filter by flagging all played SFX flags in the range (R,S),
-            // where R is the actual reset frame, and S is the original starting frame.
-            // Note: we can skip frame S, because the current SFX filter array is already initialized by frame S.
-            for ( uint32_t i = netMan.getFrame() + 1; i < origFrame; ++i )
-            {
-                for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
-                    AsmHacks::sfxFilterArray[j] |= _sfxHistory [ i % NUM_ROLLBACK_STATES ][j];
-            }
+    for ( uint32_t i = netMan.getFrame() + 1; i < origFrame; ++i )
+    {
+        const SfxHistory& sfxHistory = _sfxHistory [ i % NUM_ROLLBACK_STATES ];
 
-            // We set the SFX filter flag to 0x80. Since played (but filtered) SFX are incremented,
-            // unplayed sound effects in the filter will stay as 0 or 0x80.
-            for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
-            {
-                if ( AsmHacks::sfxFilterArray[j] )
-                    AsmHacks::sfxFilterArray[j] = 0x80;
-            }
+        if ( ! sfxHistory.any )
+            continue;
+
+        for ( size_t k = 0; k < SfxWords; ++k )
+            played[k] |= sfxHistory.bits[k];
+    }
 
-            return true;
+    // We set the SFX filter flag to 0x80. Since played (but filtered) SFX are incremented,
+    // unplayed sound effects in the filter will stay as 0 or 0x80.
+    for ( size_t i = 0; i < CC_SFX_ARRAY_LEN; i += sizeof ( uint32_t ) )
+    {
+        const uint32_t playedBits = ( played[i / 32] >> ( i % 32 ) ) & 0xF;
+
+        if ( ! playedBits && ! loadSfxWord ( &AsmHacks::sfxFilterArray[i] ) )
+            continue;
+
+        for ( size_t j = 0; j < sizeof ( uint32_t ); ++j )
+        {
+            if ( AsmHacks::sfxFilterArray[i + j] || ( playedBits & ( 1u << j ) ) )
+                AsmHacks::sfxFilterArray[i + j] = 0x80;
         }
     }
 
-    LOG ( "Failed to load state: indexedFrame=%s", indexedFrame );
-    return false;
+    return true;
 }
 
-void DllRollbackManager::saveRerunSounds ( uint32_t frame )
+bool DllRollbackManager::getStateHash ( IndexedFrame& indexedFrame, uint32_t& hash ) const
 {
-    uint8_t *currentSfxArray = &_sfxHistory [ frame % NUM_ROLLBACK_STATES ][0];
+    const size_t pos = findState ( indexedFrame );
 
-    // Rewrite the sound effects history during re-run
-    for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
+    if ( pos == NoState )
+        return false;
+
+    indexedFrame = getState ( pos ).indexedFrame;
+    hash = getState ( pos ).stateHash;
+    return true;
+}
+
+bool DllRollbackManager::getRegionHashes ( IndexedFrame indexedFrame, vector<uint32_t>& hashes ) const
+{
+    const size_t pos = findState ( indexedFrame );
+
+    if ( pos == NoState || getState ( pos ).indexedFrame.value != indexedFrame.value )
+        return false;
+
+    hashes = getState ( pos ).regionHashes;
+    return true;
+}
+
+string DllRollbackManager::diffRegionHashes ( const StateHashes& remote ) const
+{
+    vector<uint32_t> hashes;
+
+    if ( ! getRegionHashes ( remote.indexedFrame, hashes ) || hashes.size() != remote.hashes.size() )
+        return "";
+
+    string str;
+
+    for ( size_t i = 0; i < hashes.size(); ++i )
     {
-        if ( AsmHacks::sfxFilterArray[j] & ~0x80 )
-            currentSfxArray[j] = 1;
-        else
-            currentSfxArray[j] = 0;
+        if ( hashes[i] == remote.hashes[i] )
+            continue;
+
+        const MemDump& mem = allAddrs.addrs[i];
+
+        str += format ( "%s{ 0x%06X, 0x%06X }", ( str.empty() ? "" : "; " ), mem.addr, mem.addr + mem.size );
+
+        if ( ! mem.ptrs.empty() )
+            str += format ( " with %u pointers", mem.ptrs.size() );
     }
+
+    return str;
+}
+
+bool DllRollbackManager::dumpState ( IndexedFrame indexedFrame, const string& filename )
+{
+    const size_t pos = findState ( indexedFrame );
+
+    if ( pos == NoState || getState ( pos ).indexedFrame.value != indexedFrame.value )
+        return false;
+
+    waitForSave();
+
+    vector<char> image ( allAddrs.totalSize );
+    _snapshots.load ( getState ( pos ).slot, &image[0] );
+
+    ofstream fout ( filename.c_str(), ofstream::binary );
+    bool good = fout.good();
+    if ( good )
+        good = fout.write ( &image[0], image.size() ).good();
+    fout.close();
+
+    LOG ( "Dumped state: indexedFrame=%s; filename='%s'; good=%u", indexedFrame, filename, good );
+    return good;
+}
+
+bool DllRollbackManager::openSaveStateFile ( const string& filename )
+{
+    // Tie the file to the rollback data, so the images always have the same layout as allAddrs
+    const uint32_t layoutHash = hashBytes ( &binary_res_rollback_bin_start, getRollbackDataSize() );
+
+    loadRollbackData();
+
+    return _saveStateFile.open ( filename, layoutHash );
+}
+
+bool DllRollbackManager::persistState ( const NetplayManager& netMan )
+{
+    if ( ! _saveStateFile.isOpen() )
+        return false;
+
+    PersistedState state;
+    state.netplayState = netMan._state;
+    state.startWorldTime = netMan._startWorldTime;
+    state.indexedFrame = netMan._indexedFrame;
+    fegetenv ( &state.fp_env );
+
+    vector<char> image ( allAddrs.totalSize );
+    allAddrs.saveDump ( &image[0] );
+
+    const bool success = _saveStateFile.append ( state.indexedFrame.value, &state, sizeof ( state ),
+                         &image[0], image.size() );
+
+    LOG ( "Persisted state: indexedFrame=%s; success=%u", state.indexedFrame, success );
+    return success;
+}
+
+bool DllRollbackManager::loadPersistedState ( IndexedFrame& indexedFrame, NetplayManager& netMan )
+{
+    uint64_t key;
+
+    if ( ! _saveStateFile.isOpen() || ! _saveStateFile.findAtOrBefore ( indexedFrame.value, key ) )
+    {
+        LOG ( "No persisted state: indexedFrame=%s", indexedFrame );
+        return false;
+    }
+
+    const char *meta, *image;
+    size_t metaSize, imageSize;
+
+    _saveStateFile.find ( key, meta, metaSize, image, imageSize );
+
+    if ( metaSize != sizeof ( PersistedState ) || imageSize != allAddrs.totalSize )
+    {
+        LOG ( "Invalid persisted state: metaSize=%u; imageSize=%u", metaSize, imageSize );
+        return false;
+    }
+
+    PersistedState state;
+    memcpy ( &state, meta, sizeof ( state ) );
+
+    loadPersistedImage ( state, image, netMan );
+
+    indexedFrame = state.indexedFrame;
+
+    LOG ( "Loaded persisted state: indexedFrame=%s", indexedFrame );
+    return true;
+}
+
+void DllRollbackManager::loadPersistedImage ( const PersistedState& state, const char *image, NetplayManager& netMan )
+{
+    // Every rollback state is from a different timeline now
+    waitForSave();
+
+    _snapshots.clear();
+    _statesBegin = _statesCount = 0;
+    _hasPinnedState = false;
+
+    netMan._state = state.netplayState;
+    netMan._startWorldTime = state.startWorldTime;
+    netMan._indexedFrame = state.indexedFrame;
+    fesetenv ( &state.fp_env );
+
+    allAddrs.loadDump ( image );
+}
+
+bool DllRollbackManager::getKeyframe ( IndexedFrame& indexedFrame, string& keyframe )
+{
+    const size_t pos = findState ( indexedFrame );
+
+    if ( pos == NoState || getState ( pos ).indexedFrame.parts.index != indexedFrame.parts.index )
+        return false;
+
+    const GameState& gameState = getState ( pos );
+
+    // Same layout as the savestate file, the game state metadata followed by the raw bytes
+    PersistedState state;
+    state.netplayState = gameState.netplayState;
+    state.startWorldTime = gameState.startWorldTime;
+    state.indexedFrame = gameState.indexedFrame;
+    state.fp_env = gameState.fp_env;
+
+    vector<char> image ( sizeof ( state ) + allAddrs.totalSize );
+    memcpy ( &image[0], &state, sizeof ( state ) );
+
+    waitForSave();
+
+    _snapshots.load ( gameState.slot, &image[sizeof ( state )] );
+
+    // This runs on the game thread, so favour speed over size
+    keyframe.resize ( compressBound ( image.size() ) );
+    keyframe.resize ( compress ( &image[0], image.size(), &keyframe[0], keyframe.size(), KEYFRAME_COMPRESSION ) );
+
+    indexedFrame = state.indexedFrame;
+
+    LOG ( "Keyframe: indexedFrame=%s; size=%u; compressed=%u", indexedFrame, image.size(), keyframe.size() );
+    return ! keyframe.empty();
+}
+
+bool DllRollbackManager::loadKeyframe ( const string& keyframe, NetplayManager& netMan )
+{
+    loadRollbackData();
+
+    PersistedState state;
+    vector<char> image ( sizeof ( state ) + allAddrs.totalSize );
+
+    if ( keyframe.empty() || uncompress ( &keyframe[0], keyframe.size(), &image[0], image.size() ) != image.size() )
+    {
+        LOG ( "Invalid keyframe: size=%u", keyframe.size() );
+        return false;
+    }
+
+    memcpy ( &state, &image[0], sizeof ( state ) );
+
+    if ( state.netplayState != netMan._state || state.indexedFrame.parts.index != netMan.getIndex() )
+    {
+        LOG ( "Keyframe is for a different state: %s [%s]; current: %s [%s]",
+              state.netplayState, state.indexedFrame, netMan._state, netMan.getIndexedFrame() );
+        return false;
+    }
+
+    loadPersistedImage ( state, &image[sizeof ( state )], netMan );
+
+    LOG ( "Loaded keyframe: indexedFrame=%s", state.indexedFrame );
+    return true;
+}
+
+void DllRollbackManager::saveRerunSounds ( uint32_t frame )
+{
+    SfxHistory& currentSfx = _sfxHistory [ frame % NUM_ROLLBACK_STATES ];
+
+    // Rewrite the sound effects history during re-run
+    currentSfx.any = packSfx ( AsmHacks::sfxFilterArray, ( uint8_t ) ~0x80, &currentSfx.bits[0], SfxWords );
 }
 
 void DllRollbackManager::finishedRerunSounds()
 {
     // Cancel unplayed sound effects after rollback
-    for ( uint32_t j = 0; j < CC_SFX_ARRAY_LEN; ++j )
+    for ( size_t i = 0; i < CC_SFX_ARRAY_LEN; i += sizeof ( uint32_t ) )
     {
-        // Filter flag 0x80 means the SFX didn't play after rollback since the filter didn't get incremented
-        if ( AsmHacks::sfxFilterArray[j] == 0x80 )
+        if ( ! loadSfxWord ( &AsmHacks::sfxFilterArray[i] ) )
+            continue;
+
+        for ( size_t j = i; j < i + sizeof ( uint32_t ); ++j )
         {
-            // Play the SFX muted to cancel it
-            CC_SFX_ARRAY_ADDR[j] = 1;
-            AsmHacks::sfxMuteArray[j] = 1;
+            // Filter flag 0x80 means the SFX didn't play after rollback since the filter didn't get incremented
+            if ( AsmHacks::sfxFilterArray[j] == 0x80 )
+            {
+                // Play the SFX muted to cancel it
+                CC_SFX_ARRAY_ADDR[j] = 1;
+                AsmHacks::sfxMuteArray[j] = 1;
+            }
         }
     }
 
     // Cleared last played sound effects
     memset ( AsmHacks::sfxFilterArray, 0, CC_SFX_ARRAY_LEN );
+
+    if ( _rerunFrames )
+    {
+        const uint64_t rerunTime = RollbackStats::getMicroseconds() - _rerunStartTime;
+
+        addCostSample ( _avgRerunTime, double ( rerunTime ) / _rerunFrames );
+        RollbackStats::get().addRerunTime ( rerunTime );
+        _rerunFrames = 0;
+    }
+}
+
+void DllRollbackManager::updateSaveInterval()
+{
+    addCostSample ( _rollbackRate, double ( _intervalRollbacks ) / _intervalFrames );
+    _intervalFrames = _intervalRollbacks = 0;
+
+    // Find the depth that most rollbacks are within
+    uint32_t total = 0;
+    for ( uint32_t count : _rollbackDepths )
+        total += count;
+
+    uint32_t depth = 0;
+    for ( uint32_t count = 0; depth < MAX_ROLLBACK; ++depth )
+    {
+        count += _rollbackDepths[depth];
+
+        if ( count >= total * ROLLBACK_DEPTH_PERCENTILE )
+            break;
+    }
+
+    // Decay the histogram so it follows changes in the connection
+    for ( uint32_t& count : _rollbackDepths )
+        count /= 2;
+
+    uint32_t bestInterval = 1;
+    double bestCost = 0;
+
+    for ( uint32_t interval = 1; interval <= maxSaveInterval; interval *= 2 )
+    {
+        // Rollbacks re-run up to (interval - 1) extra frames, which must still fit within the maximum re-run
+        if ( depth + interval - 1 > MAX_ROLLBACK )
+            break;
+
+        // Each save is spread over the interval, and each rollback re-runs (interval - 1) / 2 extra frames on average
+        const double cost = _avgSaveTime / interval + _rollbackRate * _avgRerunTime * ( interval - 1 ) / 2;
+
+        if ( interval == 1 || cost < bestCost )
+        {
+            bestInterval = interval;
+            bestCost = cost;
+        }
+    }
+
+    if ( bestInterval != _saveInterval )
+    {
+        LOG ( "saveInterval=%u; avgSaveTime=%.1fus; avgRerunTime=%.1fus; rollbackRate=%.3f; depth=%u",
+              bestInterval, _avgSaveTime, _avgRerunTime, _rollbackRate, depth );
+    }
+
+    _saveInterval = bestInterval;
 }
@@ -2,10 +2,10 @@
 
 #include "DllNetplayManager.hpp"
 #include "Constants.hpp"
+#include "SnapshotStore.hpp"
+#include "SaveStateFile.hpp"
+#include "Thread.hpp"
 
-#include <memory>
-#include <stack>
-#include <list>
 #include <array>
 #include <cfenv>
 
@@ -40,6 +40,20 @@ class DllRollbackManager
 {
 public:
 
+    // Save game states on a worker thread. The game thread only copies the raw bytes into the scratch image,
+    // then the worker diffs and compresses them into the snapshot store while the game runs the frame.
+    // Only one save can be in flight; every other access to the snapshot store happens on the game thread,
+    // and waits for the in-flight save to finish first (see waitForSave).
+    bool asyncSave = false;
+
+    // Maximum number of frames between saved game states. Rollbacks load the newest game state at or before the
+    // target frame, and the frames in between are re-run along with the rest. The actual interval is a power of 2
+    // up to this, and is adapted to the measured save and re-run times, and to the observed rollback depths.
+    uint32_t maxSaveInterval = 1;
+
+    // Stops the worker thread
+    ~DllRollbackManager() { stopSaveThread(); }
+
     // Allocate / deallocate memory for saving game states
     void allocateStates();
     void deallocateStates();
@@ -48,12 +62,49 @@ public:
     void saveState ( const NetplayManager& netMan );
     bool loadState ( IndexedFrame indexedFrame, NetplayManager& netMan );
 
+    // Get the hash of the newest game state at or before the given frame, which is updated to the actual frame.
+    // Returns false if there is no such game state.
+    bool getStateHash ( IndexedFrame& indexedFrame, uint32_t& hash ) const;
+
+    // Get the hash of each memory region for the game state at exactly the given frame
+    bool getRegionHashes ( IndexedFrame indexedFrame, std::vector<uint32_t>& hashes ) const;
+
+    // Compare remote region hashes against the game state at the same frame, and describe the memory regions
+    // that differ. Returns an empty string if nothing differs or there is no game state to compare.
+    std::string diffRegionHashes ( const StateHashes& remote ) const;
+
+    // Write the raw bytes of the game state at exactly the given frame to a file, in the MemDumpList dump layout.
+    // Returns false if there is no such game state or the file couldn't be written.
+    bool dumpState ( IndexedFrame indexedFrame, const std::string& filename );
+
+    // Open the persistent savestate file, existing game states are kept if the rollback data is unchanged
+    bool openSaveStateFile ( const std::string& filename );
+    bool isSaveStateFileOpen() const { return _saveStateFile.isOpen(); }
+
+    // Write the current game state to the savestate file
+    bool persistState ( const NetplayManager& netMan );
+
+    // Load the newest game state at or before the given frame from the savestate file, and update the frame
+    // to the actual frame loaded. This discards the rollback states, since they are from a different timeline.
+    bool loadPersistedState ( IndexedFrame& indexedFrame, NetplayManager& netMan );
+
+    // Get the newest game state at or before the given frame, within the same index, as a compressed keyframe for
+    // spectators to catch up from. The frame is updated to the actual frame. Returns false if there is no such state.
+    bool getKeyframe ( IndexedFrame& indexedFrame, std::string& keyframe );
+
+    // Load a keyframe from getKeyframe, which must be for the current index and NetplayState.
+    // This discards the rollback states, like loadPersistedState.
+    bool loadKeyframe ( const std::string& keyframe, NetplayManager& netMan );
+
     // Save sounds during rollback re-run
     void saveRerunSounds ( uint32_t frame );
 
     // Finalize rollback sound effects
     void finishedRerunSounds();
 
+    // Get the current number of frames between saved game states
+    uint32_t getSaveInterval() const { return _saveInterval; }
+
 private:
 
     struct GameState
@@ -67,23 +118,134 @@ private:
         // Floating-point environment state
         std::fenv_t fp_env;
 
-        // The pointer to the raw bytes in the state pool
-        char *rawBytes;
+        // The slot of the raw bytes in the snapshot store
+        size_t slot;
+
+        // Hash of each memory region, and the combined hash of the whole game state
+        std::vector<uint32_t> regionHashes;
+        uint32_t stateHash;
+    };
 
-        // Save / load the game state
-        void save();
-        void load();
+    // Game state metadata written with each image in the savestate file
+    struct PersistedState
+    {
+        NetplayState netplayState;
+        uint32_t startWorldTime;
+        IndexedFrame indexedFrame;
+        std::fenv_t fp_env;
     };
 
-    // Memory pool to allocate game states
-    std::shared_ptr<char> _memoryPool;
+    // Persistent savestate file, keyed by indexedFrame
+    SaveStateFile _saveStateFile;
+
+    // Load the game state metadata and raw bytes of a persisted state or keyframe
+    void loadPersistedImage ( const PersistedState& state, const char *image, NetplayManager& netMan );
+
+    // Snapshot store for the raw bytes of each game state, only the blocks that changed are stored per state
+    SnapshotStore _snapshots;
+
+    // Contiguous image of the raw bytes, used to save / load the game state
+    std::vector<char> _scratchImage;
+
+    // Ring of saved game states in chronological order.
+    // Each entry owns one slot in the snapshot store, which is only swapped with the pinned state's slot.
+    std::array<GameState, NUM_ROLLBACK_STATES> _states;
+
+    // Ring position of the oldest game state, and the number of game states
+    size_t _statesBegin = 0, _statesCount = 0;
+
+    // The newest evicted game state at or before the remote frame. Rollbacks never go before the remote frame,
+    // so this is kept until a newer game state replaces it, to guarantee there is always a state to rollback to.
+    GameState _pinnedState;
+    bool _hasPinnedState = false;
+
+    // Indicates no game state
+    static const size_t NoState = SIZE_MAX;
+
+    // Get the game state at the given position, 0 is the oldest
+    GameState& getState ( size_t i ) { return _states[ ( _statesBegin + i ) % _states.size() ]; }
+    const GameState& getState ( size_t i ) const { return _states[ ( _statesBegin + i ) % _states.size() ]; }
 
-    // Unused indices in the memory pool, each game state has the same size
-    std::stack<size_t> _freeStack;
+    // Get the position of the newest game state at or before the given frame, or NoState if there isn't one
+    size_t findState ( IndexedFrame indexedFrame ) const;
 
-    // List of saved game states in chronological order
-    std::list<GameState> _statesList;
+    // Remove the oldest game state, pinning it if it is at or before the remote frame
+    void evictState ( const NetplayManager& netMan );
+
+    // Save / load the raw bytes of a game state
+    void saveRawBytes ( GameState& state );
+    void loadRawBytes ( const GameState& state );
+
+    // Worker thread for saving game states when asyncSave is enabled
+    class SaveThread : public Thread
+    {
+    public:
+
+        SaveThread ( DllRollbackManager& rollMan ) : _rollMan ( rollMan ) {}
+
+        void run() override;
+
+    private:
+
+        DllRollbackManager& _rollMan;
+    };
+
+    SaveThread _saveThread { *this };
+
+    // Mutex and condition for the in-flight save
+    Mutex _saveMutex;
+    CondVar _saveCond;
+
+    // The slot and base slot of the in-flight save, NoSlot if there is nothing in flight
+    size_t _pendingSlot = SnapshotStore::NoSlot;
+    size_t _pendingBaseSlot = SnapshotStore::NoSlot;
+
+    // Flag to tell the worker thread to exit
+    bool _stopSaveThread = false;
+
+    // Wait for the in-flight save to finish, this must be called before accessing the snapshot store
+    void waitForSave();
+
+    // Stop the worker thread after finishing the in-flight save
+    void stopSaveThread();
+
+    // Current number of frames between saved game states, a power of 2 so both sides save on common frames
+    uint32_t _saveInterval = 1;
+
+    // Moving averages of the time to save a game state, and the time to re-run one frame, in microseconds
+    double _avgSaveTime = 0, _avgRerunTime = 0;
+
+    // Moving average of the number of rollbacks per frame
+    double _rollbackRate = 0;
+
+    // Number of frames and rollbacks since the save interval was last updated
+    uint32_t _intervalFrames = 0, _intervalRollbacks = 0;
+
+    // Decaying histogram of rollback depths, the last bucket counts every deeper rollback
+    std::array<uint32_t, MAX_ROLLBACK + 1> _rollbackDepths;
+
+    // The frame of the last call to saveState, whether or not it saved a game state
+    IndexedFrame _lastSaveFrame = {{ 0, 0 }};
+
+    // Start time and number of frames of the current re-run, 0 frames if not re-running
+    uint64_t _rerunStartTime = 0;
+    uint32_t _rerunFrames = 0;
+
+    // Pick the save interval with the lowest expected cost per frame
+    void updateSaveInterval();
+
+    // Number of 32-bit words in a bitset of sound effects
+    static const size_t SfxWords = ( CC_SFX_ARRAY_LEN + 31 ) / 32;
+
+    // Sound effects played on a frame, packed one bit per sound effect
+    struct SfxHistory
+    {
+        std::array<uint32_t, SfxWords> bits;
+
+        // Indicates if any bit is set, so frames without sounds can be skipped
+        bool any;
+    };
 
     // History of sound effect playbacks
-    std::array<std::array<uint8_t, CC_SFX_ARRAY_LEN>, NUM_ROLLBACK_STATES> _sfxHistory;
+    std::array<SfxHistory, NUM_ROLLBACK_STATES> _sfxHistory;
 };
@@ -0,0 +1,158 @@
+#include "DllRollbackStats.hpp"
+#include "Logger.hpp"
+#include "StringUtils.hpp"
+
+#include <windows.h>
+
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+
+// Percentiles reported for each latency histogram
+static const double percentiles[] = { 0.5, 0.95, 0.99 };
+
+
+static size_t getBucket ( uint64_t latency )
+{
+    if ( latency < 4 )
+        return latency;
+
+    const size_t bit = 63 - __builtin_clzll ( latency );
+
+    return 4 * ( bit - 1 ) + ( ( latency >> ( bit - 2 ) ) & 3 );
+}
+
+static uint64_t getBucketLimit ( size_t bucket )
+{
+    if ( bucket < 4 )
+        return bucket;
+
+    const size_t bit = bucket / 4 + 1;
+
+    return ( ( 4 + ( bucket % 4 ) ) << ( bit - 2 ) ) + ( 1llu << ( bit - 2 ) ) - 1;
+}
+
+void LatencyHistogram::add ( uint64_t latency )
+{
+    ++_buckets[getBucket ( latency )];
+    ++_count;
+    _max = max ( _max, latency );
+}
+
+uint64_t LatencyHistogram::getPercentile ( double fraction ) const
+{
+    if ( _count == 0 )
+        return 0;
+
+    uint32_t count = 0;
+
+    for ( size_t i = 0; i < _buckets.size(); ++i )
+    {
+        count += _buckets[i];
+
+        if ( count >= fraction * _count )
+            return min ( getBucketLimit ( i ), _max );
+    }
+
+    return _max;
+}
+
+void LatencyHistogram::clear()
+{
+    _buckets.fill ( 0 );
+    _count = 0;
+    _max = 0;
+}
+
+
+void RollbackStats::addRollback ( uint32_t depth, uint32_t rerunFrames )
+{
+    ++_numRollbacks;
+    _numRerunFrames += rerunFrames;
+    ++_depths [ min<uint32_t> ( depth, _depths.size() - 1 ) ];
+}
+
+void RollbackStats::addFrame ( bool waitedOnInputs )
+{
+    ++_numFrames;
+
+    if ( waitedOnInputs )
+        ++_numWaitedFrames;
+}
+
+string RollbackStats::getSummary() const
+{
+    // Deepest rollback so far
+    size_t maxDepth = 0;
+    for ( size_t i = 0; i < _depths.size(); ++i )
+    {
+        if ( _depths[i] )
+            maxDepth = i;
+    }
+
+    return format ( "Rollbacks: %u (%u frames re-run, max depth %u%s)\n"
+                    "Save: %llu / %llu us; Load: %llu / %llu us (p50 / p99)\n"
+                    "Waited on inputs: %u / %u frames",
+                    _numRollbacks, _numRerunFrames,
+                    maxDepth, ( maxDepth + 1 == _depths.size() ? "+" : "" ),
+                    _saveTimes.getPercentile ( 0.5 ), _saveTimes.getPercentile ( 0.99 ),
+                    _loadTimes.getPercentile ( 0.5 ), _loadTimes.getPercentile ( 0.99 ),
+                    _numWaitedFrames, _numFrames );
+}
+
+void RollbackStats::exportResults ( const string& filename, uint32_t timestamp ) const
+{
+    if ( _numFrames == 0 )
+        return;
+
+    // timestamp,frames,waitedFrames,rollbacks,rerunFrames,depths,save p50/p95/p99/max,load ...,rerun ...
+    string line = format ( "%u,%u,%u,%u,%u,", timestamp, _numFrames, _numWaitedFrames, _numRollbacks, _numRerunFrames );
+
+    for ( size_t i = 0; i < _depths.size(); ++i )
+        line += format ( "%s%u", ( i ? ";" : "" ), _depths[i] );
+
+    for ( const LatencyHistogram *latencies : { &_saveTimes, &_loadTimes, &_rerunTimes } )
+    {
+        for ( double fraction : percentiles )
+            line += format ( ",%llu", latencies->getPercentile ( fraction ) );
+
+        line += format ( ",%llu", latencies->getMax() );
+    }
+
+    ofstream fout ( filename.c_str(), ios::out | ios::app );
+    fout << line << endl;
+    fout.close();
+
+    LOG ( "%s", line );
+}
+
+void RollbackStats::clear()
+{
+    _numFrames = _numWaitedFrames = 0;
+    _numRollbacks = _numRerunFrames = 0;
+    _depths.fill ( 0 );
+    _saveTimes.clear();
+    _loadTimes.clear();
+    _rerunTimes.clear();
+}
+
+uint64_t RollbackStats::getMicroseconds()
+{
+    static uint64_t ticksPerSecond = 0;
+
+    if ( ! ticksPerSecond )
+        QueryPerformanceFrequency ( ( LARGE_INTEGER * ) &ticksPerSecond );
+
+    uint64_t ticks;
+    QueryPerformanceCounter ( ( LARGE_INTEGER * ) &ticks );
+
+    return ( ticks / ticksPerSecond ) * 1000000 + ( ( ticks % ticksPerSecond ) * 1000000 ) / ticksPerSecond;
+}
+
+RollbackStats& RollbackStats::get()
+{
+    static RollbackStats instance;
+    return instance;
+}
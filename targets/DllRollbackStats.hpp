@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Constants.hpp"
+
+#include <string>
+#include <array>
+
+
+// Histogram of latencies in microseconds, with 4 buckets per power of 2, so percentiles are within 25%
+class LatencyHistogram
+{
+public:
+
+    // Add a latency sample
+    void add ( uint64_t latency );
+
+    // Get the latency that the given fraction of samples are at or below, rounded up to the bucket limit
+    uint64_t getPercentile ( double fraction ) const;
+
+    // Get the number of samples and the maximum sample
+    uint32_t getCount() const { return _count; }
+    uint64_t getMax() const { return _max; }
+
+    void clear();
+
+private:
+
+    std::array<uint32_t, 4 * 64> _buckets = {{}};
+
+    uint32_t _count = 0;
+
+    uint64_t _max = 0;
+};
+
+
+// Rollback telemetry for the current match
+class RollbackStats
+{
+public:
+
+    // Record a rollback to the given depth, which re-runs the given number of frames
+    void addRollback ( uint32_t depth, uint32_t rerunFrames );
+
+    // Record the time taken to save / load a game state, and to re-run all the frames of a rollback
+    void addSaveTime ( uint64_t latency ) { _saveTimes.add ( latency ); }
+    void addLoadTime ( uint64_t latency ) { _loadTimes.add ( latency ); }
+    void addRerunTime ( uint64_t latency ) { _rerunTimes.add ( latency ); }
+
+    // Record a frame, and whether it had to wait for remote inputs
+    void addFrame ( bool waitedOnInputs );
+
+    // Get a short summary for the overlay
+    std::string getSummary() const;
+
+    // Append the stats to a CSV file, with the same timestamp as the match results
+    void exportResults ( const std::string& filename, uint32_t timestamp ) const;
+
+    // Reset everything for the next match
+    void clear();
+
+    // Get the current time in microseconds, the timer manager only has millisecond precision
+    static uint64_t getMicroseconds();
+
+    // Get the singleton instance
+    static RollbackStats& get();
+
+private:
+
+    // Number of frames, and the frames that waited on remote inputs
+    uint32_t _numFrames = 0, _numWaitedFrames = 0;
+
+    // Number of rollbacks, and the total number of frames re-run
+    uint32_t _numRollbacks = 0, _numRerunFrames = 0;
+
+    // Histogram of rollback depths, the last bucket counts every deeper rollback
+    std::array<uint32_t, MAX_ROLLBACK + 2> _depths = {{}};
+
+    // Latencies in microseconds
+    LatencyHistogram _saveTimes, _loadTimes, _rerunTimes;
+
+    // Private constructor, etc. for singleton class
+    RollbackStats() {}
+    RollbackStats ( const RollbackStats& );
+    const RollbackStats& operator= ( const RollbackStats& );
+};
@@ -1,5 +1,6 @@
 #include "SpectatorManager.hpp"
 #include "DllNetplayManager.hpp"
+#include "DllRollbackManager.hpp"
 #include "ProcessManager.hpp"
 #include "Logger.hpp"
 #include "Algorithms.hpp"
@@ -8,11 +9,13 @@
 using namespace std;
 
 
-SpectatorManager::SpectatorManager ( NetplayManager *netManPtr, const ProcessManager *procManPtr )
+SpectatorManager::SpectatorManager ( NetplayManager *netManPtr, const ProcessManager *procManPtr,
+                                     DllRollbackManager *rollManPtr )
     : _spectatorListPos ( _spectatorList.end() )
     , _spectatorMapPos ( _spectatorMap.end() )
     , _netManPtr ( netManPtr )
     , _procManPtr ( procManPtr )
+    , _rollManPtr ( rollManPtr )
 {
 }
 
@@ -107,8 +110,51 @@ void SpectatorManager::popSpectator ( Socket *socketPtr )
 
 void SpectatorManager::newRngState ( const RngState& rngState )
 {
+    if ( _spectatorList.empty() )
+        return;
+
+    // Encode once for every spectator
+    const MsgPtr msg = rngState.clone();
+    const string bytes = ::Protocol::encode ( msg );
+
     for ( Socket *socket : _spectatorList )
-        socket->send ( rngState );
+        socket->sendEncoded ( msg, bytes );
+}
+
+const SpectatorBroadcast& SpectatorManager::getBroadcast ( MsgType type, const IndexedFrame& pos )
+{
+    const auto key = make_pair ( pos.value, type );
+    const auto it = _broadcasts.find ( key );
+
+    if ( it != _broadcasts.end() )
+        return it->second;
+
+    SpectatorBroadcast& broadcast = _broadcasts[key];
+    broadcast.pos = pos;
+
+    switch ( type )
+    {
+        case MsgType::BothInputs:
+            broadcast.msg = _netManPtr->getBothInputs ( broadcast.pos );
+            break;
+
+        case MsgType::RngState:
+            broadcast.msg = _netManPtr->getRngState ( pos.parts.index );
+            break;
+
+        case MsgType::MenuIndex:
+            broadcast.msg = _netManPtr->getRetryMenuIndex ( pos.parts.index );
+            break;
+
+        default:
+            ASSERT_IMPOSSIBLE;
+            break;
+    }
+
+    if ( broadcast.msg )
+        broadcast.bytes = ::Protocol::encode ( broadcast.msg );
+
+    return broadcast;
 }
 
 void SpectatorManager::frameStepSpectators()
@@ -132,6 +178,13 @@ void SpectatorManager::frameStepSpectators()
     if ( _spectatorMapPos == _spectatorMap.cend() )
         _spectatorMapPos = _spectatorMap.cbegin();
 
+    // Send keyframes every frame, so spectators can catch up as soon as possible
+    for ( auto& kv : _spectatorMap )
+    {
+        if ( kv.second.keyframe )
+            sendKeyframeChunk ( kv.first, kv.second );
+    }
+
     // Number of times to broadcast per frame
     const uint32_t multiplier = 1 + ( _spectatorList.size() * 2 ) / ( NUM_INPUTS + 1 );
 
@@ -141,6 +194,9 @@ void SpectatorManager::frameStepSpectators()
     if ( ( *CC_WORLD_TIMER_ADDR ) % interval )
         return;
 
+    // Spectators at the same position this frame share the same encoded messages
+    _broadcasts.clear();
+
     for ( uint32_t i = 0; i < multiplier; ++i )
     {
         // Once we reach the end
@@ -164,14 +220,38 @@ void SpectatorManager::frameStepSpectators()
         Spectator& spectator = it->second;
         const uint32_t oldIndex = spectator.pos.parts.index;
 
+        // Drop spectators that have fallen behind the preserved inputs
+        if ( oldIndex < _netManPtr->getStartIndex() )
+        {
+            LOG ( "socket=%08x; spectator.pos=[%s]; startIndex=%u; dropped",
+                  socket, spectator.pos, _netManPtr->getStartIndex() );
+
+            popSpectator ( socket );
+
+            if ( _spectatorList.empty() )
+                break;
+
+            continue;
+        }
+
         LOG ( "socket=%08x; spectator.pos=[%s]; preserveStartIndex=%u",
               socket, spectator.pos, _netManPtr->preserveStartIndex );
 
-        MsgPtr msgBothInputs = _netManPtr->getBothInputs ( spectator.pos );
+        // Wait for our own keyframe before sending anything after it
+        if ( ! startKeyframe ( socket, spectator ) )
+        {
+            ++_spectatorListPos;
+            _currentMinIndex = min ( _currentMinIndex, spectator.pos.parts.index );
+            continue;
+        }
+
+        const SpectatorBroadcast& bothInputs = getBroadcast ( MsgType::BothInputs, spectator.pos );
+
+        spectator.pos = bothInputs.pos;
 
         // Send inputs if available
-        if ( msgBothInputs )
-            socket->send ( msgBothInputs );
+        if ( bothInputs.msg )
+            socket->sendEncoded ( bothInputs.msg, bothInputs.bytes );
 
         // Clear sent flags whenever the index changes
         if ( spectator.pos.parts.index > oldIndex )
@@ -180,21 +260,22 @@ void SpectatorManager::frameStepSpectators()
             spectator.sentRetryMenuIndex = false;
         }
 
-        MsgPtr msgRngState = _netManPtr->getRngState ( oldIndex );
+        const IndexedFrame oldPos = {{ 0, oldIndex }};
+        const SpectatorBroadcast& rngState = getBroadcast ( MsgType::RngState, oldPos );
 
         // Send RngState ONCE if available
-        if ( msgRngState && !spectator.sentRngState )
+        if ( rngState.msg && !spectator.sentRngState )
         {
-            socket->send ( msgRngState );
+            socket->sendEncoded ( rngState.msg, rngState.bytes );
             spectator.sentRngState = true;
         }
 
-        MsgPtr msgMenuIndex = _netManPtr->getRetryMenuIndex ( oldIndex );
+        const SpectatorBroadcast& menuIndex = getBroadcast ( MsgType::MenuIndex, oldPos );
 
         // Send retry menu index ONCE if available
-        if ( msgMenuIndex && !spectator.sentRetryMenuIndex )
+        if ( menuIndex.msg && !spectator.sentRetryMenuIndex )
         {
-            socket->send ( msgMenuIndex );
+            socket->sendEncoded ( menuIndex.msg, menuIndex.bytes );
             spectator.sentRetryMenuIndex = true;
         }
 
@@ -232,3 +313,217 @@ const IpAddrPort& SpectatorManager::getRandomSpectatorAddress() const
     LOG ( "'%s'", it->second.serverAddr );
     return it->second.serverAddr;
 }
+
+void SpectatorManager::setSpectatorSubtree ( Socket *socketPtr, const MsgPtr& subtree )
+{
+    const auto it = _spectatorMap.find ( socketPtr );
+
+    if ( it == _spectatorMap.end() )
+        return;
+
+    it->second.subtree = subtree;
+}
+
+MsgPtr SpectatorManager::getSpectatorSubtree() const
+{
+    SpectatorSubtree *subtree = new SpectatorSubtree();
+
+    // Spectators joining directly would be too deep
+    if ( spectatorDepth < MAX_SPECTATOR_DEPTH && numSpectators() < maxSpectators )
+    {
+        subtree->freeSlots = maxSpectators - numSpectators();
+        subtree->freeDepth = 0;
+    }
+
+    subtree->maxDelay = spectatorDelay;
+
+    for ( const auto& kv : _spectatorMap )
+    {
+        ++subtree->numSpectators;
+
+        if ( ! kv.second.subtree )
+            continue;
+
+        const SpectatorSubtree& child = kv.second.subtree->getAs<SpectatorSubtree>();
+
+        subtree->numSpectators += child.numSpectators;
+        subtree->maxDelay = max ( subtree->maxDelay, child.maxDelay );
+
+        if ( child.freeSlots == 0 )
+            continue;
+
+        subtree->freeSlots += child.freeSlots;
+        subtree->freeDepth = min<uint32_t> ( subtree->freeDepth, child.freeDepth + 1 );
+    }
+
+    return MsgPtr ( subtree );
+}
+
+// Check if a is a better subtree to redirect new spectators to than b
+static bool isBetterSubtree ( const SpectatorSubtree& a, const SpectatorSubtree *b )
+{
+    if ( a.freeSlots == 0 )
+        return false;
+
+    if ( ! b )
+        return true;
+
+    if ( a.freeDepth != b->freeDepth )
+        return ( a.freeDepth < b->freeDepth );
+
+    return ( a.freeSlots > b->freeSlots );
+}
+
+const IpAddrPort& SpectatorManager::getFreeSpectatorAddress ( const IpAddrPort& clientAddr,
+                                                              const MsgPtr& clientSubtree ) const
+{
+    const IpAddrPort *bestAddr = 0;
+    const SpectatorSubtree *best = 0;
+
+    if ( ! clientAddr.empty() && clientSubtree && isBetterSubtree ( clientSubtree->getAs<SpectatorSubtree>(), best ) )
+    {
+        bestAddr = &clientAddr;
+        best = &clientSubtree->getAs<SpectatorSubtree>();
+    }
+
+    for ( const auto& kv : _spectatorMap )
+    {
+        if ( kv.second.serverAddr.port == 0 || ! kv.second.subtree )
+            continue;
+
+        if ( ! isBetterSubtree ( kv.second.subtree->getAs<SpectatorSubtree>(), best ) )
+            continue;
+
+        bestAddr = &kv.second.serverAddr;
+        best = &kv.second.subtree->getAs<SpectatorSubtree>();
+    }
+
+    if ( ! bestAddr )
+        return NullAddress;
+
+    LOG ( "'%s'; %s", *bestAddr, *best );
+    return *bestAddr;
+}
+
+void SpectatorManager::sendSpectatorDepth ( uint8_t depth, const IndexedFrame& liveIndexedFrame )
+{
+    if ( _spectatorList.empty() )
+        return;
+
+    // Encode once for every spectator
+    const MsgPtr msg ( new SpectatorDepth ( depth, liveIndexedFrame ) );
+    const string bytes = ::Protocol::encode ( msg );
+
+    for ( Socket *socket : _spectatorList )
+        socket->sendEncoded ( msg, bytes );
+}
+
+bool SpectatorManager::startKeyframe ( Socket *socket, Spectator& spectator )
+{
+    if ( spectator.keyframe )
+        return true;
+
+    const uint32_t index = spectator.pos.parts.index;
+
+    // The first frame of the next inputs sent to the spectator
+    const uint32_t nextFrame = spectator.pos.parts.frame + 1 - NUM_INPUTS;
+
+    if ( _netManPtr->config.mode.isSpectate() )
+    {
+        // We jumped to our keyframe, so we don't have the inputs before it
+        if ( _keyframeFrame.parts.index != index || nextFrame >= _keyframeFrame.parts.frame )
+            return true;
+
+        if ( ! _keyframe )
+            return false;
+    }
+    else
+    {
+        if ( ! _netManPtr->isInRollback() || index != _netManPtr->getIndex() )
+            return true;
+
+        // Only game states from confirmed inputs can be sent
+        IndexedFrame target = _netManPtr->getConfirmedFrame();
+
+        if ( target.parts.index != index || target.parts.frame < nextFrame + MIN_KEYFRAME_FRAMES )
+            return true;
+
+        // Spectators that join around the same time share the same keyframe
+        if ( ! _keyframe || _keyframeFrame.parts.index != index
+                || _keyframeFrame.parts.frame < nextFrame + MIN_KEYFRAME_FRAMES )
+        {
+            string keyframe;
+
+            if ( ! _rollManPtr->getKeyframe ( target, keyframe ) )
+                return true;
+
+            _keyframe = make_shared<const string> ( move ( keyframe ) );
+            _keyframeFrame = target;
+        }
+
+        if ( _keyframeFrame.parts.frame < nextFrame + MIN_KEYFRAME_FRAMES )
+            return true;
+    }
+
+    spectator.keyframe = _keyframe;
+    spectator.keyframeFrame = _keyframeFrame;
+    spectator.keyframeOffset = 0;
+
+    // Continue from the inputs of the keyframe
+    spectator.pos.parts.frame = _keyframeFrame.parts.frame + NUM_INPUTS - 1;
+
+    LOG ( "socket=%08x; keyframeFrame=[%s]; size=%u; nextFrame=%u",
+          socket, spectator.keyframeFrame, spectator.keyframe->size(), nextFrame );
+
+    // The first chunk is sent before any inputs after the keyframe, so the spectator waits for the rest
+    sendKeyframeChunk ( socket, spectator );
+    return true;
+}
+
+void SpectatorManager::sendKeyframeChunk ( Socket *socket, Spectator& spectator )
+{
+    const string& keyframe = *spectator.keyframe;
+    const uint32_t len = min<uint32_t> ( KEYFRAME_CHUNK_SIZE, keyframe.size() - spectator.keyframeOffset );
+
+    socket->send ( new SpectatorKeyframe ( spectator.keyframeFrame, keyframe.size(), spectator.keyframeOffset,
+                                           keyframe.substr ( spectator.keyframeOffset, len ) ) );
+
+    spectator.keyframeOffset += len;
+
+    if ( spectator.keyframeOffset < keyframe.size() )
+        return;
+
+    LOG ( "socket=%08x; keyframeFrame=[%s]; sent", socket, spectator.keyframeFrame );
+
+    spectator.keyframe.reset();
+}
+
+void SpectatorManager::gotKeyframeChunk ( const SpectatorKeyframe& chunk )
+{
+    // Start over for a different keyframe
+    if ( chunk.indexedFrame.value != _keyframeFrame.value || chunk.size != _keyframeSize )
+    {
+        _keyframe.reset();
+        _keyframeFrame = chunk.indexedFrame;
+        _keyframeSize = chunk.size;
+        _keyframeBuffer.clear();
+    }
+
+    // Resume from the bytes received so far, ignoring chunks that don't continue them
+    if ( _keyframe || chunk.offset > _keyframeBuffer.size()
+            || chunk.offset + chunk.data.size() <= _keyframeBuffer.size() )
+    {
+        return;
+    }
+
+    _keyframeBuffer.append ( chunk.data, _keyframeBuffer.size() - chunk.offset, string::npos );
+
+    if ( _keyframeBuffer.size() < _keyframeSize )
+        return;
+
+    _keyframeBuffer.resize ( _keyframeSize );
+    _keyframe = make_shared<const string> ( move ( _keyframeBuffer ) );
+    _keyframeBuffer.clear();
+
+    LOG ( "keyframeFrame=[%s]; size=%u", _keyframeFrame, _keyframeSize );
+}
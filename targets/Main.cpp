@@ -252,7 +252,46 @@ int main ( int argc, char *argv[] )
             Options::Tournament, 0, "T", "tournament", Arg::None,
             "  --tournament, -T     Tournament mode.\n"
             "                         Forces offline versus mode, 2 rounds,\n"
-            "                         with 1.5 second held start button."
+            "                         with 1.5 second held start button.\n"
+        },
+
+        {
+            Options::AsyncSave, 0, "", "async-save", Arg::None,
+            "  --async-save         Save rollback states on a worker thread.\n"
+        },
+
+        {
+            Options::SaveInterval, 0, "", "save-interval", Arg::Numeric,
+            "  --save-interval N    Save rollback states at most every N frames.\n"
+            "                         The interval adapts between 1 and N frames,\n"
+            "                         based on the save cost and rollback depths.\n"
+        },
+
+        {
+            Options::PreserveIndices, 0, "", "preserve-indices", Arg::Numeric,
+            "  --preserve-indices N Preserve inputs for spectators up to N indices back.\n"
+            "                         Spectators that fall further behind are dropped.\n"
+        },
+
+        {
+            Options::Prediction, 0, "", "prediction", Arg::Numeric,
+            "  --prediction N       Remote input prediction during rollback.\n"
+            "                         0 holds the last input (default), 1 releases the buttons\n"
+            "                         but keeps the direction, 2 learns the most frequent next input.\n"
+        },
+
+        {
+            Options::AutoDelay, 0, "", "auto-delay", Arg::Numeric,
+            "  --auto-delay N       Recommend the delay and rollback from the measured latency.\n"
+            "                         1 shows the recommendations at the start of each round,\n"
+            "                         2 also applies them.\n"
+        },
+
+        {
+            Options::MaxSpectators, 0, "", "max-spectators", Arg::Numeric,
+            "  --max-spectators N   Maximum number of spectators served directly, the rest are\n"
+            "                         redirected down the spectator tree. Use a higher value\n"
+            "                         to relay for more spectators with more upload bandwidth.\n"
         },
 
 #ifndef RELEASE
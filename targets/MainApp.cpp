@@ -676,8 +676,11 @@ struct MainApp
             case MsgType::PlayerInputs:
             {
                 // TODO log dummy inputs to check sync
-                PlayerInputs inputs ( msg->getAs<PlayerInputs>().indexedFrame );
-                inputs.indexedFrame.parts.frame += netplayConfig.delay * 2;
+                IndexedFrame indexedFrame = msg->getAs<PlayerInputs>().indexedFrame;
+                indexedFrame.parts.frame += netplayConfig.delay * 2;
+
+                PlayerInputs inputs ( indexedFrame );
+                inputs.ackedEndFrame = { msg->getAs<PlayerInputs>().getEndFrame(), inputs.getIndex() };
 
                 for ( uint32_t i = 0; i < inputs.size(); ++i )
                 {
@@ -1103,6 +1106,7 @@ struct MainApp
                 return;
 
             case MsgType::IpAddrPort:
+            case MsgType::SpectatorSubtree:
                 if ( ctrlSocket && ctrlSocket->isConnected() )
                     ctrlSocket->send ( msg );
                 return;
@@ -0,0 +1,124 @@
+#ifndef RELEASE
+
+#include "DelayTuner.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+
+// Add samples of a constant latency, and frames that never waited on remote inputs
+static void addSamples ( DelayTuner& tuner, double latency, uint32_t count = MIN_TUNER_SAMPLES )
+{
+    for ( uint32_t i = 0; i < count; ++i )
+    {
+        tuner.addLatency ( latency );
+        tuner.addFrame ( false );
+    }
+}
+
+
+TEST ( DelayTuner, NotEnoughSamples )
+{
+    DelayTuner tuner;
+    uint8_t delay = 0, rollback = 0;
+
+    addSamples ( tuner, 6, MIN_TUNER_SAMPLES - 1 );
+
+    EXPECT_FALSE ( tuner.recommend ( 0, 0, delay, rollback ) );
+
+    addSamples ( tuner, 6, 1 );
+
+    EXPECT_TRUE ( tuner.recommend ( 0, 0, delay, rollback ) );
+
+    tuner.clear();
+
+    EXPECT_FALSE ( tuner.recommend ( 0, 0, delay, rollback ) );
+}
+
+TEST ( DelayTuner, SplitDelayRollback )
+{
+    DelayTuner tuner;
+    uint8_t delay = 0, rollback = 0;
+
+    addSamples ( tuner, 6 );
+
+    // The delay only covers the latency beyond the target rollback depth
+    ASSERT_TRUE ( tuner.recommend ( 0, 0, delay, rollback ) );
+    EXPECT_EQ ( 6 - TARGET_ROLLBACK_DEPTH, delay );
+    EXPECT_EQ ( TARGET_ROLLBACK_DEPTH, rollback );
+
+    // Already within the targets
+    EXPECT_FALSE ( tuner.recommend ( delay, rollback, delay, rollback ) );
+
+    EXPECT_DOUBLE_EQ ( 6, tuner.getMeanLatency() );
+    EXPECT_DOUBLE_EQ ( 0, tuner.getJitter() );
+
+    // Latency that can't be covered by the maximum rollback must be covered by the delay
+    tuner.clear();
+    addSamples ( tuner, MAX_ROLLBACK + 20 );
+
+    ASSERT_TRUE ( tuner.recommend ( 0, 0, delay, rollback ) );
+    EXPECT_EQ ( MAX_TUNER_DELAY, delay );
+    EXPECT_EQ ( MAX_ROLLBACK, rollback );
+}
+
+TEST ( DelayTuner, BurstWaits )
+{
+    DelayTuner tuner;
+    uint8_t delay = 0, rollback = 0;
+
+    addSamples ( tuner, 2 );
+
+    // The latency is covered by the current settings
+    EXPECT_FALSE ( tuner.recommend ( 1, 1, delay, rollback ) );
+
+    // Waiting more often than the budget means the inputs arrived in bursts, so add another frame of rollback
+    for ( uint32_t i = 0; i < MIN_TUNER_SAMPLES / 10; ++i )
+        tuner.addFrame ( true );
+
+    ASSERT_TRUE ( tuner.recommend ( 1, 1, delay, rollback ) );
+    EXPECT_EQ ( 1, delay );
+    EXPECT_EQ ( 2, rollback );
+}
+
+TEST ( DelayTuner, Hysteresis )
+{
+    DelayTuner tuner;
+    uint8_t delay = 0, rollback = 0;
+
+    addSamples ( tuner, 6 );
+
+    // Slightly higher than needed, so both are kept
+    EXPECT_FALSE ( tuner.recommend ( 3, 4, delay, rollback ) );
+    EXPECT_EQ ( 3, delay );
+    EXPECT_EQ ( 4, rollback );
+
+    // Lowered once they're higher than needed by at least the hysteresis
+    ASSERT_TRUE ( tuner.recommend ( 2 + TUNER_HYSTERESIS, 4 + TUNER_HYSTERESIS, delay, rollback ) );
+    EXPECT_EQ ( 2, delay );
+    EXPECT_EQ ( 4, rollback );
+
+    // Always raised
+    ASSERT_TRUE ( tuner.recommend ( 1, 1, delay, rollback ) );
+    EXPECT_EQ ( 2, delay );
+    EXPECT_EQ ( 4, rollback );
+}
+
+TEST ( DelayTuner, RollbackDepths )
+{
+    DelayTuner tuner;
+    uint8_t delay = 0, rollback = 0;
+
+    addSamples ( tuner, 2 );
+
+    // Deep rollbacks even though the latency is low, so the delay is raised to keep them within the target depth
+    for ( uint32_t i = 0; i < 100; ++i )
+        tuner.addRollback ( TARGET_ROLLBACK_DEPTH + 3 );
+
+    ASSERT_TRUE ( tuner.recommend ( 0, 8, delay, rollback ) );
+    EXPECT_EQ ( 3, delay );
+    EXPECT_EQ ( 1, rollback );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,75 @@
+#ifndef RELEASE
+
+#include "InputHistory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_FRAMES      ( 3 * INPUT_HISTORY_SIZE )
+#define MAX_RANGE       ( 200 )
+
+
+TEST ( InputHistory, MatchesScan )
+{
+    srand ( 1 );
+
+    InputHistory history;
+    vector<uint16_t> inputs;
+
+    for ( uint32_t frame = 0; frame < NUM_FRAMES; ++frame )
+    {
+        // Mostly held inputs, so held checks can pass
+        const uint16_t input = ( frame > 0 && rand() % 4 ? inputs.back() : uint16_t ( rand() % 0x10000 ) );
+
+        inputs.push_back ( input );
+        history.set ( frame, input );
+
+        // Occasionally change some older inputs, like a rollback would
+        if ( rand() % 50 == 0 && frame > 10 )
+        {
+            const uint32_t changed = frame - rand() % 10;
+
+            history.invalidate ( changed );
+
+            for ( uint32_t i = changed; i <= frame; ++i )
+            {
+                inputs[i] = rand() % 0x10000;
+                history.set ( i, inputs[i] );
+            }
+        }
+
+        ASSERT_EQ ( frame + 1, history.getEndFrame() );
+        ASSERT_EQ ( InputHistory::getChannels ( inputs[frame] ), history.getFrameChannels ( frame ) );
+
+        const uint32_t end = frame + 1;
+        const uint32_t first = end - min<uint32_t> ( end, 1 + rand() % MAX_RANGE );
+        const uint16_t buttons = 1 << ( rand() % 12 );
+
+        bool upDown = false, pressed = false, held = true;
+
+        for ( uint32_t i = first; i < end; ++i )
+        {
+            upDown |= ( ( inputs[i] & 0xF ) == 2 || ( inputs[i] & 0xF ) == 8 );
+            pressed |= ( ( inputs[i] >> 4 ) & buttons ) != 0;
+            held &= ( ( inputs[i] >> 4 ) & buttons ) != 0;
+        }
+
+        const uint32_t upDownChannels = ( InputHistory::getDirectionChannel ( 2 )
+                                          | InputHistory::getDirectionChannel ( 8 ) );
+
+        EXPECT_EQ ( upDown, history.any ( upDownChannels, first, end ) );
+        EXPECT_EQ ( pressed, history.any ( InputHistory::getButtonChannels ( buttons ), first, end ) );
+        EXPECT_EQ ( held, history.all ( InputHistory::getButtonChannels ( buttons ), first, end ) );
+    }
+
+    // Only the newest frames are kept
+    EXPECT_EQ ( uint32_t ( NUM_FRAMES - INPUT_HISTORY_SIZE ), history.getBeginFrame() );
+    EXPECT_FALSE ( history.all ( 0xFFFFFFFF, 0, NUM_FRAMES ) );
+}
+
+#endif // NOT RELEASE
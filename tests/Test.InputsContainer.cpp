@@ -0,0 +1,202 @@
+#ifndef RELEASE
+
+#include "InputsContainer.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_ITERATIONS  ( 2000 )
+#define MAX_INDEX       ( 6 )
+#define MAX_FRAME       ( 3 * INPUTS_PAGE_SIZE )
+
+
+// Reference behaviour of InputsContainer, with one vector per index
+struct ReferenceInputs
+{
+    vector<vector<uint16_t>> inputs;
+
+    uint16_t lastInputBefore ( size_t index ) const
+    {
+        for ( index = min ( index, inputs.size() ); index > 0; --index )
+        {
+            if ( ! inputs[index - 1].empty() )
+                return inputs[index - 1].back();
+        }
+
+        return 0;
+    }
+
+    uint16_t get ( size_t index, size_t frame ) const
+    {
+        if ( index >= inputs.size() || inputs[index].empty() )
+            return lastInputBefore ( index );
+
+        return ( frame >= inputs[index].size() ? inputs[index].back() : inputs[index][frame] );
+    }
+
+    void resize ( size_t index, size_t frame, size_t n )
+    {
+        uint16_t last = 0;
+
+        if ( index >= inputs.size() )
+        {
+            last = lastInputBefore ( inputs.size() );
+            inputs.resize ( index + 1 );
+        }
+        else if ( ! inputs[index].empty() )
+        {
+            last = inputs[index].back();
+        }
+
+        if ( frame + n > inputs[index].size() )
+            inputs[index].resize ( frame + n, last );
+    }
+};
+
+
+TEST ( InputsContainer, MatchesReference )
+{
+    InputsContainer<uint16_t> container;
+    ReferenceInputs reference;
+
+    for ( size_t i = 0; i < NUM_ITERATIONS; ++i )
+    {
+        const uint32_t index = rand() % MAX_INDEX;
+        const uint32_t frame = rand() % MAX_FRAME;
+        const size_t n = 1 + rand() % ( INPUTS_PAGE_SIZE + 10 );
+        const uint16_t input = rand();
+
+        switch ( rand() % 5 )
+        {
+            case 0:
+                container.set ( index, frame, input );
+                if ( index >= reference.inputs.size() || frame >= reference.inputs[index].size() )
+                {
+                    reference.resize ( index, frame, 1 );
+                    reference.inputs[index][frame] = input;
+                }
+                break;
+
+            case 1:
+                container.assign ( index, frame, input );
+                reference.resize ( index, frame, 1 );
+                reference.inputs[index][frame] = input;
+                break;
+
+            case 2:
+                container.set ( index, frame, input, n );
+                reference.resize ( index, frame, n );
+                fill ( reference.inputs[index].begin() + frame, reference.inputs[index].begin() + frame + n, input );
+                break;
+
+            case 3:
+            {
+                vector<uint16_t> inputs ( n );
+                for ( size_t j = 0; j < n; ++j )
+                    inputs[j] = ( rand() % 64 ? reference.get ( index, frame + j ) : rand() % 4 );
+
+                // Compare the first changed frame against checking each input
+                IndexedFrame changed = MaxIndexedFrame;
+
+                for ( size_t j = 0; j < n; ++j )
+                {
+                    if ( reference.get ( index, frame + j ) != inputs[j] )
+                    {
+                        changed = {{ uint32_t ( frame + j ), index }};
+                        break;
+                    }
+                }
+
+                container.clearLastChangedFrame();
+                container.set ( index, frame, &inputs[0], n, 0 );
+                ASSERT_EQ ( changed.value, container.getLastChangedFrame().value );
+
+                reference.resize ( index, frame, n );
+                copy ( inputs.begin(), inputs.end(), reference.inputs[index].begin() + frame );
+                break;
+            }
+
+            default:
+                if ( rand() % 20 == 0 )
+                {
+                    const size_t count = rand() % 3;
+                    container.eraseIndexOlderThan ( count );
+                    if ( count + 1 >= reference.inputs.size() )
+                        reference.inputs.clear();
+                    else
+                        reference.inputs.erase ( reference.inputs.begin(), reference.inputs.begin() + count );
+                }
+                break;
+        }
+
+        ASSERT_EQ ( reference.inputs.size(), container.getEndIndex() );
+
+        for ( uint32_t j = 0; j < MAX_INDEX; ++j )
+        {
+            ASSERT_EQ ( j < reference.inputs.size() ? reference.inputs[j].size() : 0, container.getEndFrame ( j ) );
+
+            for ( uint32_t k = 0; k < MAX_FRAME + 2; k += 7 )
+                ASSERT_EQ ( reference.get ( j, k ), container.get ( j, k ) );
+        }
+    }
+
+    for ( uint32_t j = 0; j < reference.inputs.size(); ++j )
+    {
+        vector<uint16_t> inputs ( reference.inputs[j].size() );
+
+        if ( ! inputs.empty() )
+            container.get ( j, 0, &inputs[0], inputs.size() );
+
+        EXPECT_EQ ( reference.inputs[j], inputs );
+    }
+}
+
+TEST ( InputsContainer, Predictions )
+{
+    InputsContainer<uint16_t> container;
+
+    const uint16_t known[] = { 1, 2, 3 };
+    container.set ( 0, 0, known, 3 );
+
+    // Predictions are returned after the last known input
+    container.predict ( 0, 3, 7 );
+    container.predict ( 0, 5, 8 );
+    EXPECT_EQ ( 3, container.getEndFrame ( 0 ) );
+    EXPECT_EQ ( 6, container.getPredictedEndFrame() );
+    EXPECT_EQ ( 7, container.get ( 0, 3 ) );
+    EXPECT_EQ ( 3, container.get ( 0, 4 ) );
+    EXPECT_EQ ( 8, container.get ( 0, 5 ) );
+    EXPECT_EQ ( 3, container.get ( 0, 6 ) );
+
+    // Existing predictions can't be changed
+    container.predict ( 0, 3, 9 );
+    EXPECT_EQ ( 7, container.get ( 0, 3 ) );
+
+    // Correct predictions don't indicate a change, and skipped frames are filled with the predictions
+    const uint16_t correct[] = { 3 };
+    container.set ( 0, 4, correct, 1, 0 );
+    EXPECT_EQ ( MaxIndexedFrame.value, container.getLastChangedFrame().value );
+    EXPECT_EQ ( 7, container.get ( 0, 3 ) );
+    EXPECT_EQ ( 8, container.get ( 0, 5 ) );
+
+    // Wrong predictions indicate a change, and the remaining predictions are discarded
+    container.predict ( 0, 6, 10 );
+    const uint16_t wrong[] = { 4 };
+    container.set ( 0, 5, wrong, 1, 0 );
+    EXPECT_EQ ( ( IndexedFrame {{ 5, 0 }}.value ), container.getLastChangedFrame().value );
+    EXPECT_EQ ( 6, container.getPredictedEndFrame() );
+    EXPECT_EQ ( 4, container.get ( 0, 6 ) );
+
+    // Predictions are discarded by a new index
+    container.predict ( 0, 6, 11 );
+    container.set ( 1, 0, 12 );
+    EXPECT_EQ ( 12, container.get ( 1, 0 ) );
+    EXPECT_EQ ( 4, container.get ( 0, 6 ) );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,177 @@
+#ifndef RELEASE
+
+#include "MemDump.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+
+#define NUM_ELEMENTS    ( 64 )
+#define ELEMENT_SIZE    ( 0x40 )
+#define PTR_OFFSET      ( 0x30 )
+#define CHILD_SIZE      ( 0x20 )
+
+
+// Save the memory dumps using the original recursive method
+static vector<char> saveDumpRecursive ( const MemDumpList& list )
+{
+    vector<char> dump ( list.totalSize );
+    char *ptr = &dump[0];
+
+    for ( const MemDump& mem : list.addrs )
+        mem.saveDump ( ptr );
+
+    return dump;
+}
+
+TEST ( MemDump, CopyPlanRandom )
+{
+    // Array of elements, each with a pointer to a child, which points to a grandchild, similar to the effects array
+    vector<char> elements ( NUM_ELEMENTS * ELEMENT_SIZE );
+    vector<vector<char>> children ( NUM_ELEMENTS, vector<char> ( CHILD_SIZE ) );
+    vector<vector<char>> grandChildren ( NUM_ELEMENTS, vector<char> ( CHILD_SIZE ) );
+    vector<char> misc ( 123 );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+    {
+        // Leave some pointers null
+        char *child = ( i % 5 ? &children[i][0] : 0 );
+        char *grandChild = ( i % 7 ? &grandChildren[i][0] : 0 );
+
+        * ( char ** ) &elements[i * ELEMENT_SIZE + PTR_OFFSET] = child;
+        * ( char ** ) &children[i][0] = grandChild;
+    }
+
+    const MemDump element ( &elements[0], ELEMENT_SIZE, {
+        MemDumpPtr ( PTR_OFFSET, 0, CHILD_SIZE, {
+            MemDumpPtr ( 0, sizeof ( char * ), CHILD_SIZE - sizeof ( char * ) )
+        } )
+    } );
+
+    MemDumpList list;
+    list.append ( MemDump ( &misc[0], misc.size() ) );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+        list.append ( element, ELEMENT_SIZE * i );
+
+    list.update();
+
+    ASSERT_EQ ( 2, list.addrs.size() );
+
+    // Randomize everything except the pointers
+    auto randomize = [&] ( vector<char>& bytes, size_t skip )
+    {
+        for ( size_t i = skip; i < bytes.size(); ++i )
+            bytes[i] = rand();
+    };
+
+    randomize ( misc, 0 );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+    {
+        for ( size_t j = 0; j < PTR_OFFSET; ++j )
+            elements[i * ELEMENT_SIZE + j] = rand();
+
+        randomize ( children[i], sizeof ( char * ) );
+        randomize ( grandChildren[i], 0 );
+    }
+
+    const vector<char> expected = saveDumpRecursive ( list );
+
+    vector<char> dump ( list.totalSize );
+    list.saveDump ( &dump[0] );
+
+    EXPECT_TRUE ( dump == expected );
+
+    // Clobber the data, then check that loading restores it
+    const vector<char> originalMisc = misc;
+    const vector<vector<char>> originalGrandChildren = grandChildren;
+
+    randomize ( misc, 0 );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+        randomize ( grandChildren[i], 0 );
+
+    list.loadDump ( &dump[0] );
+
+    EXPECT_TRUE ( misc == originalMisc );
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+    {
+        // The first pointer-sized bytes of each grandchild aren't part of the dump
+        if ( i % 5 && i % 7 )
+        {
+            EXPECT_TRUE ( equal ( grandChildren[i].begin() + sizeof ( char * ), grandChildren[i].end(),
+                                  originalGrandChildren[i].begin() + sizeof ( char * ) ) );
+        }
+    }
+
+    EXPECT_TRUE ( saveDumpRecursive ( list ) == expected );
+}
+
+TEST ( MemDump, HashSkipsPointers )
+{
+    vector<char> elements ( NUM_ELEMENTS * ELEMENT_SIZE );
+    vector<vector<char>> children ( NUM_ELEMENTS, vector<char> ( CHILD_SIZE ) );
+
+    for ( char& c : elements )
+        c = rand();
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+    {
+        for ( char& c : children[i] )
+            c = rand();
+
+        * ( char ** ) &elements[i * ELEMENT_SIZE + PTR_OFFSET] = &children[i][0];
+    }
+
+    const MemDump element ( &elements[0], ELEMENT_SIZE, { MemDumpPtr ( PTR_OFFSET, 0, CHILD_SIZE ) } );
+
+    // Only every other element, so the regions aren't merged
+    MemDumpList list;
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; i += 2 )
+        list.append ( element, ELEMENT_SIZE * i );
+
+    list.update();
+
+    ASSERT_EQ ( NUM_ELEMENTS / 2, list.addrs.size() );
+
+    auto hashDump = [&] ( vector<char>& dump )
+    {
+        dump.resize ( list.totalSize );
+        list.saveDump ( &dump[0] );
+
+        vector<uint32_t> hashes ( list.addrs.size() );
+        list.hashRegions ( &dump[0], &hashes[0] );
+        return hashes;
+    };
+
+    vector<char> dump, otherDump;
+    const vector<uint32_t> hashes = hashDump ( dump );
+
+    // Same data at different addresses, like the heap of the other process
+    vector<vector<char>> otherChildren = children;
+
+    for ( size_t i = 0; i < NUM_ELEMENTS; ++i )
+        * ( char ** ) &elements[i * ELEMENT_SIZE + PTR_OFFSET] = &otherChildren[i][0];
+
+    EXPECT_TRUE ( hashDump ( otherDump ) == hashes );
+    EXPECT_FALSE ( otherDump == dump );
+
+    // Any other byte still changes the hash of its region
+    ++elements[PTR_OFFSET - 1];
+    ++otherChildren[2][0];
+
+    const vector<uint32_t> changedHashes = hashDump ( otherDump );
+
+    EXPECT_NE ( hashes[0], changedHashes[0] );
+    EXPECT_NE ( hashes[1], changedHashes[1] );
+    EXPECT_EQ ( hashes[2], changedHashes[2] );
+}
+
+#endif // NOT RELEASE
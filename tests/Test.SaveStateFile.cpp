@@ -0,0 +1,80 @@
+#ifndef RELEASE
+
+#include "SaveStateFile.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+
+#define TEST_FILE       "test_savestates.bin"
+#define IMAGE_SIZE      ( 3 * 1024 * 1024 + 123 )
+#define NUM_RECORDS     ( 5 )
+#define LAYOUT_HASH     ( 0x1234 )
+
+
+TEST ( SaveStateFile, AppendReopen )
+{
+    remove ( TEST_FILE );
+
+    vector<char> image ( IMAGE_SIZE );
+
+    {
+        SaveStateFile file;
+        ASSERT_TRUE ( file.open ( TEST_FILE, LAYOUT_HASH ) );
+
+        // The records are larger than the allocation granularity, and not aligned to it
+        for ( uint32_t i = 0; i < NUM_RECORDS; ++i )
+        {
+            fill ( image.begin(), image.end(), char ( i ) );
+            EXPECT_TRUE ( file.append ( 10 * i, &i, sizeof ( i ), &image[0], image.size() ) );
+        }
+
+        EXPECT_EQ ( NUM_RECORDS, file.size() );
+
+        // A newer record with the same key replaces the older one
+        fill ( image.begin(), image.end(), char ( 9 ) );
+        const uint64_t newMeta = 9;
+        EXPECT_TRUE ( file.append ( 40, &newMeta, sizeof ( newMeta ), &image[0], image.size() ) );
+        EXPECT_EQ ( NUM_RECORDS, file.size() );
+    }
+
+    {
+        SaveStateFile file;
+        ASSERT_TRUE ( file.open ( TEST_FILE, LAYOUT_HASH ) );
+        EXPECT_EQ ( NUM_RECORDS, file.size() );
+
+        const char *meta, *data;
+        size_t metaSize, dataSize;
+
+        ASSERT_TRUE ( file.find ( 30, meta, metaSize, data, dataSize ) );
+        EXPECT_EQ ( sizeof ( uint32_t ), metaSize );
+        EXPECT_EQ ( 3, * ( const uint32_t * ) meta );
+        EXPECT_EQ ( IMAGE_SIZE, dataSize );
+        EXPECT_EQ ( 3, data[0] );
+        EXPECT_EQ ( 3, data[dataSize - 1] );
+
+        uint64_t key;
+        ASSERT_TRUE ( file.findAtOrBefore ( 25, key ) );
+        EXPECT_EQ ( 20, key );
+        EXPECT_FALSE ( file.find ( 25, meta, metaSize, data, dataSize ) );
+
+        ASSERT_TRUE ( file.find ( 40, meta, metaSize, data, dataSize ) );
+        EXPECT_EQ ( sizeof ( uint64_t ), metaSize );
+        EXPECT_EQ ( 9, data[dataSize - 1] );
+    }
+
+    // Records are discarded if the layout changed
+    {
+        SaveStateFile file;
+        ASSERT_TRUE ( file.open ( TEST_FILE, LAYOUT_HASH + 1 ) );
+        EXPECT_EQ ( 0, file.size() );
+    }
+
+    remove ( TEST_FILE );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,137 @@
+#ifndef RELEASE
+
+#include "Test.Socket.hpp"
+#include "SharedMemoryPipe.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+
+#define NUM_MESSAGES    ( 10 )
+
+// A bit over a third of the ring, so the ring wraps around and frames are split across the end
+#define MESSAGE_SIZE    ( SHARED_MEMORY_RING_SIZE / 3 + 123 )
+
+
+struct TestPipeOwner : public SharedMemoryPipe::Owner
+{
+    vector<string> received;
+    bool disconnected = false;
+
+    void pipeDisconnected ( SharedMemoryPipe *pipe ) override
+    {
+        disconnected = true;
+    }
+
+    void pipeRead ( SharedMemoryPipe *pipe, const MsgPtr& msg ) override
+    {
+        ASSERT_EQ ( MsgType::TestMessage, msg->getMsgType() );
+        received.push_back ( msg->getAs<TestMessage>().str );
+    }
+};
+
+// Random bytes, so the message size doesn't change with compression
+static MsgPtr randomMessage ( vector<string>& sent )
+{
+    string str ( MESSAGE_SIZE, 0 );
+
+    for ( char& c : str )
+        c = rand();
+
+    sent.push_back ( str );
+
+    MsgPtr msg ( new TestMessage ( str ) );
+    msg->compressionLevel = 0;
+    return msg;
+}
+
+
+TEST ( SharedMemoryPipe, SendWrapAround )
+{
+    TestPipeOwner server, client;
+
+    SharedMemoryPipePtr serverPipe = SharedMemoryPipe::create ( &server, "cccaster_test_pipe_send" );
+    ASSERT_TRUE ( serverPipe.get() );
+
+    SharedMemoryPipePtr clientPipe = SharedMemoryPipe::open ( &client, "cccaster_test_pipe_send" );
+    ASSERT_TRUE ( clientPipe.get() );
+
+    // Only one side can create the mapping
+    EXPECT_FALSE ( SharedMemoryPipe::create ( &server, "cccaster_test_pipe_send" ).get() );
+
+    vector<string> sent;
+
+    for ( size_t i = 0; i < NUM_MESSAGES; ++i )
+    {
+        EXPECT_TRUE ( serverPipe->send ( randomMessage ( sent ) ) );
+
+        SharedMemoryPipe::checkAll();
+
+        ASSERT_EQ ( sent.size(), client.received.size() );
+    }
+
+    EXPECT_TRUE ( sent == client.received );
+    EXPECT_FALSE ( server.disconnected );
+    EXPECT_FALSE ( client.disconnected );
+}
+
+TEST ( SharedMemoryPipe, QueueWhenFull )
+{
+    TestPipeOwner server, client;
+
+    SharedMemoryPipePtr serverPipe = SharedMemoryPipe::create ( &server, "cccaster_test_pipe_queue" );
+    ASSERT_TRUE ( serverPipe.get() );
+
+    SharedMemoryPipePtr clientPipe = SharedMemoryPipe::open ( &client, "cccaster_test_pipe_queue" );
+    ASSERT_TRUE ( clientPipe.get() );
+
+    vector<string> sent;
+
+    // Only a few messages fit in the ring, the rest are queued
+    for ( size_t i = 0; i < NUM_MESSAGES; ++i )
+        EXPECT_TRUE ( serverPipe->send ( randomMessage ( sent ) ) );
+
+    EXPECT_TRUE ( client.received.empty() );
+
+    SharedMemoryPipe::checkAll();
+
+    EXPECT_LT ( client.received.size(), sent.size() );
+
+    // Each check frees space in the ring, then flushes more queued messages
+    for ( size_t i = 0; i < 2 * NUM_MESSAGES && client.received.size() < sent.size(); ++i )
+        SharedMemoryPipe::checkAll();
+
+    EXPECT_TRUE ( sent == client.received );
+}
+
+TEST ( SharedMemoryPipe, Close )
+{
+    TestPipeOwner server, client;
+
+    SharedMemoryPipePtr serverPipe = SharedMemoryPipe::create ( &server, "cccaster_test_pipe_close" );
+    ASSERT_TRUE ( serverPipe.get() );
+
+    SharedMemoryPipePtr clientPipe = SharedMemoryPipe::open ( &client, "cccaster_test_pipe_close" );
+    ASSERT_TRUE ( clientPipe.get() );
+
+    vector<string> sent;
+
+    EXPECT_TRUE ( clientPipe->send ( randomMessage ( sent ) ) );
+
+    clientPipe.reset();
+
+    SharedMemoryPipe::checkAll();
+
+    // Messages sent before closing are still read
+    EXPECT_TRUE ( sent == server.received );
+    EXPECT_TRUE ( server.disconnected );
+    EXPECT_FALSE ( serverPipe->isConnected() );
+    EXPECT_FALSE ( serverPipe->send ( randomMessage ( sent ) ) );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,133 @@
+#ifndef RELEASE
+
+#include "SnapshotStore.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+
+#define IMAGE_SIZE      ( 37 * SNAPSHOT_BLOCK_SIZE + 123 )
+#define NUM_SLOTS       ( 16 )
+#define NUM_ITERATIONS  ( 200 )
+
+
+TEST ( SnapshotStore, SaveLoadRandom )
+{
+    SnapshotStore store;
+    store.initialize ( IMAGE_SIZE, NUM_SLOTS, 4 * IMAGE_SIZE );
+
+    vector<char> image ( IMAGE_SIZE );
+    for ( char& c : image )
+        c = rand();
+
+    vector<vector<char>> expected ( NUM_SLOTS );
+    vector<size_t> saved;
+
+    for ( size_t i = 0; i < NUM_ITERATIONS; ++i )
+    {
+        // Change a few random bytes each frame
+        for ( int j = rand() % 8; j > 0; --j )
+            image[rand() % IMAGE_SIZE] = rand();
+
+        // Free the oldest slot until there is enough room
+        while ( saved.size() == NUM_SLOTS || ! store.canSave() )
+        {
+            store.release ( saved.front() );
+            saved.erase ( saved.begin() );
+        }
+
+        size_t slot = 0;
+        while ( find ( saved.begin(), saved.end(), slot ) != saved.end() )
+            ++slot;
+
+        store.save ( slot, &image[0], saved.empty() ? SnapshotStore::NoSlot : saved.back() );
+        saved.push_back ( slot );
+        expected[slot] = image;
+
+        EXPECT_LE ( store.getLastDirtyBlocks(), saved.size() == 1 ? store.getNumBlocks() : 8 );
+    }
+
+    vector<char> loaded ( IMAGE_SIZE );
+
+    for ( size_t slot : saved )
+    {
+        store.load ( slot, &loaded[0] );
+        EXPECT_TRUE ( loaded == expected[slot] );
+    }
+
+    for ( size_t slot : saved )
+        store.release ( slot );
+
+    EXPECT_EQ ( 0, store.getUsedBytes() );
+}
+
+TEST ( SnapshotStore, RollbackRandom )
+{
+    SnapshotStore store;
+    store.initialize ( IMAGE_SIZE, NUM_SLOTS, 4 * IMAGE_SIZE );
+
+    vector<char> image ( IMAGE_SIZE );
+    for ( char& c : image )
+        c = rand();
+
+    vector<vector<char>> expected ( NUM_SLOTS );
+    vector<size_t> saved;
+    vector<char> loaded ( IMAGE_SIZE );
+
+    for ( size_t i = 0; i < NUM_ITERATIONS; ++i )
+    {
+        // Occasionally load an older snapshot and release everything after it
+        if ( saved.size() > 4 && rand() % 10 == 0 )
+        {
+            const size_t target = rand() % saved.size();
+
+            store.load ( saved[target], &loaded[0] );
+            EXPECT_TRUE ( loaded == expected[saved[target]] );
+
+            while ( saved.size() > target + 1 )
+            {
+                store.release ( saved.back() );
+                saved.pop_back();
+            }
+
+            image = loaded;
+        }
+
+        // Change a random range of bytes each frame
+        const size_t start = rand() % IMAGE_SIZE;
+        for ( size_t j = start; j < min<size_t> ( IMAGE_SIZE, start + rand() % 2000 ); ++j )
+            image[j] = rand();
+
+        while ( saved.size() == NUM_SLOTS || ! store.canSave() )
+        {
+            store.release ( saved.front() );
+            saved.erase ( saved.begin() );
+        }
+
+        size_t slot = 0;
+        while ( find ( saved.begin(), saved.end(), slot ) != saved.end() )
+            ++slot;
+
+        store.save ( slot, &image[0], saved.empty() ? SnapshotStore::NoSlot : saved.back() );
+        saved.push_back ( slot );
+        expected[slot] = image;
+    }
+
+    for ( size_t slot : saved )
+    {
+        store.load ( slot, &loaded[0] );
+        EXPECT_TRUE ( loaded == expected[slot] );
+    }
+
+    for ( size_t slot : saved )
+        store.release ( slot );
+
+    EXPECT_EQ ( 0, store.getUsedBytes() );
+}
+
+#endif // NOT RELEASE
@@ -0,0 +1,189 @@
+#include "MemDump.hpp"
+#include "InputsContainer.hpp"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+
+#define LOG_FILE "benchmark.log"
+
+// Number of times to run each benchmark
+#define NUM_ITERATIONS ( 1000 )
+
+// Number of frames of inputs already known, and the number of frames in each batch of received inputs
+#define NUM_KNOWN_FRAMES ( 3600 )
+#define NUM_BATCH_FRAMES ( 30 )
+
+
+// Run a function NUM_ITERATIONS times, and return the average time in microseconds
+template<typename F>
+static double timeIt ( const F& func )
+{
+    const auto start = chrono::high_resolution_clock::now();
+
+    for ( size_t i = 0; i < NUM_ITERATIONS; ++i )
+        func();
+
+    const auto end = chrono::high_resolution_clock::now();
+
+    return chrono::duration<double, micro> ( end - start ).count() / NUM_ITERATIONS;
+}
+
+
+// Allocate the memory pointed to by a list of child pointers, and point the parent at it
+static void allocatePtrs ( const vector<MemDumpPtr>& ptrs, vector<unique_ptr<char[]>>& blocks )
+{
+    for ( const MemDumpPtr& ptr : ptrs )
+    {
+        const size_t blockSize = ptr.dstOffset + ptr.size;
+
+        blocks.push_back ( unique_ptr<char[]> ( new char[blockSize] ) );
+        generate ( blocks.back().get(), blocks.back().get() + blockSize, rand );
+
+        * ( char ** ) ( ptr.parent->getAddr() + ptr.srcOffset ) = blocks.back().get();
+
+        allocatePtrs ( ptr.ptrs, blocks );
+    }
+}
+
+// Compare MemDumpBase::saveDump / loadDump against the MemDumpList copy plan, on a synthetic memory image
+// with the same layout as the given rollback memory data.
+static bool benchmarkMemDump ( const string& filename )
+{
+    MemDumpList original;
+
+    if ( ! original.load ( filename ) || original.empty() )
+    {
+        PRINT ( "Failed to load '%s'", filename );
+        return false;
+    }
+
+    // Relocate the static address ranges into a synthetic image
+    char *const minAddr = original.addrs.front().addr;
+    char *const maxAddr = original.addrs.back().addr + original.addrs.back().size;
+
+    vector<char> image ( maxAddr - minAddr );
+    generate ( image.begin(), image.end(), rand );
+
+    MemDumpList allAddrs;
+    allAddrs.append ( original.addrs, &image[0] - minAddr );
+    allAddrs.update();
+
+    // Allocate separate memory for everything that is pointed to
+    vector<unique_ptr<char[]>> blocks;
+
+    for ( const MemDump& mem : allAddrs.addrs )
+        allocatePtrs ( mem.ptrs, blocks );
+
+    PRINT ( "totalSize=%u; addrs=%u; pointers=%u; imageSize=%u",
+            allAddrs.totalSize, allAddrs.addrs.size(), blocks.size(), image.size() );
+
+    vector<char> recursiveDump ( allAddrs.totalSize ), planDump ( allAddrs.totalSize );
+
+    const double recursiveSave = timeIt ( [&]()
+    {
+        char *dump = &recursiveDump[0];
+        for ( const MemDump& mem : allAddrs.addrs )
+            mem.saveDump ( dump );
+    } );
+
+    const double planSave = timeIt ( [&]() { allAddrs.saveDump ( &planDump[0] ); } );
+
+    if ( recursiveDump != planDump )
+    {
+        PRINT ( "Copy plan saved different bytes!" );
+        return false;
+    }
+
+    const double recursiveLoad = timeIt ( [&]()
+    {
+        const char *dump = &recursiveDump[0];
+        for ( const MemDump& mem : allAddrs.addrs )
+            mem.loadDump ( dump );
+    } );
+
+    const double planLoad = timeIt ( [&]() { allAddrs.loadDump ( &planDump[0] ); } );
+
+    PRINT ( "save: recursive=%.1fus; plan=%.1fus", recursiveSave, planSave );
+    PRINT ( "load: recursive=%.1fus; plan=%.1fus", recursiveLoad, planLoad );
+    return true;
+}
+
+
+// Compare InputsContainer::set change detection against checking each input with get, on batches of inputs
+// that are the same as the known inputs except for the last frame.
+static bool benchmarkInputs()
+{
+    InputsContainer<uint16_t> inputs;
+
+    vector<uint16_t> known ( NUM_KNOWN_FRAMES );
+    for ( uint16_t& input : known )
+        input = rand() % 4;
+
+    inputs.set ( 0, 0, &known[0], known.size() );
+
+    vector<uint16_t> batch ( NUM_BATCH_FRAMES );
+    uint32_t frame = 0;
+    IndexedFrame getChanged = MaxIndexedFrame;
+
+    const double getTime = timeIt ( [&]()
+    {
+        frame = ( frame + 7 ) % ( NUM_KNOWN_FRAMES - NUM_BATCH_FRAMES );
+        copy ( known.begin() + frame, known.begin() + frame + batch.size(), batch.begin() );
+        batch.back() ^= 1;
+
+        for ( size_t i = 0; i < batch.size(); ++i )
+        {
+            if ( inputs.get ( 0, frame + i ) == batch[i] )
+                continue;
+
+            getChanged.value = min ( getChanged.value, IndexedFrame {{ uint32_t ( frame + i ), 0 }}.value );
+            break;
+        }
+    } );
+
+    frame = 0;
+
+    const double setTime = timeIt ( [&]()
+    {
+        frame = ( frame + 7 ) % ( NUM_KNOWN_FRAMES - NUM_BATCH_FRAMES );
+        copy ( known.begin() + frame, known.begin() + frame + batch.size(), batch.begin() );
+        batch.back() ^= 1;
+
+        inputs.set ( 0, frame, &batch[0], batch.size(), 0 );
+        inputs.set ( 0, frame, &known[frame], batch.size() );
+    } );
+
+    if ( inputs.getLastChangedFrame().value != getChanged.value )
+    {
+        PRINT ( "Change detection found a different frame!" );
+        return false;
+    }
+
+    PRINT ( "inputs: get=%.3fus; set=%.3fus (set includes restoring the known inputs)", getTime, setTime );
+    return true;
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    if ( argc > 1 && string ( argv[1] ) == "-h" )
+    {
+        PRINT ( "Usage: %s [rollback.bin]", argv[0] );
+        return -1;
+    }
+
+    Logger::get().initialize ( LOG_FILE, 0 );
+
+    bool success = benchmarkInputs();
+
+    if ( argc > 1 )
+        success = benchmarkMemDump ( argv[1] ) && success;
+
+    Logger::get().deinitialize();
+    return ( success ? 0 : -1 );
+}
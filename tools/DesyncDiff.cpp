@@ -0,0 +1,262 @@
+#include "MemDump.hpp"
+#include "Thread.hpp"
+
+#include <dirent.h>
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+#define LOG_FILE "desync_diff.log"
+
+// Default number of worker threads
+#define DEFAULT_NUM_THREADS ( 4 )
+
+// Suffixes of the two dump files of a desync capture, see DllMain::checkStateHashes
+#define DUMP_SUFFIX_P1 "_p1.dump"
+#define DUMP_SUFFIX_P2 "_p2.dump"
+
+
+// Rollback memory data, which describes the layout of each dump
+static MemDumpList allAddrs;
+
+// Pair of dump files to compare
+struct DiffJob
+{
+    string name, fileA, fileB;
+
+    // Output report
+    string report;
+};
+
+
+static bool readFile ( const string& filename, string& data )
+{
+    ifstream fin ( filename.c_str(), ifstream::binary );
+
+    if ( ! fin.good() )
+        return false;
+
+    fin.seekg ( 0, fin.end );
+    data.resize ( fin.tellg() );
+    fin.seekg ( 0, fin.beg );
+    fin.read ( &data[0], data.size() );
+
+    return fin.good();
+}
+
+static bool endsWith ( const string& str, const string& suffix )
+{
+    return ( str.size() >= suffix.size() && str.compare ( str.size() - suffix.size(), suffix.size(), suffix ) == 0 );
+}
+
+// Report the byte ranges that differ in a memory dump, then recurse into its child pointers.
+// Static addresses are reported as absolute addresses, pointers as offsets from the pointed to address.
+static void diffMemDump ( const MemDumpBase& mem, const string& name, const char *addr,
+                          const char *a, const char *b, size_t& offset, string& report )
+{
+    for ( size_t i = 0; i < mem.size; )
+    {
+        if ( a[offset + i] == b[offset + i] )
+        {
+            ++i;
+            continue;
+        }
+
+        const size_t start = i;
+
+        while ( i < mem.size && a[offset + i] != b[offset + i] )
+            ++i;
+
+        if ( addr )
+            report += format ( "%s: 0x%06X [ %u bytes ]\n", name, addr + start, i - start );
+        else
+            report += format ( "%s: +0x%X [ %u bytes ]\n", name, start, i - start );
+    }
+
+    offset += mem.size;
+
+    for ( const MemDumpPtr& ptr : mem.ptrs )
+        diffMemDump ( ptr, name + format ( " -> [0x%X]+0x%X", ptr.srcOffset, ptr.dstOffset ), 0, a, b, offset, report );
+}
+
+static void diffFiles ( DiffJob& job )
+{
+    string a, b;
+
+    if ( ! readFile ( job.fileA, a ) || ! readFile ( job.fileB, b ) )
+    {
+        job.report = "Failed to read files!\n";
+        return;
+    }
+
+    if ( a.size() != allAddrs.totalSize || b.size() != allAddrs.totalSize )
+    {
+        job.report = format ( "Size mismatch: %u and %u bytes, expected %u!\n", a.size(), b.size(), allAddrs.totalSize );
+        return;
+    }
+
+    for ( size_t i = 0; i < allAddrs.addrs.size(); ++i )
+    {
+        const MemDump& mem = allAddrs.addrs[i];
+        size_t offset = allAddrs.getRegionOffset ( i );
+
+        // Skip regions that are completely equal
+        if ( memcmp ( &a[offset], &b[offset], allAddrs.getRegionSize ( i ) ) == 0 )
+            continue;
+
+        diffMemDump ( mem, format ( "{ 0x%06X, 0x%06X }", mem.addr, mem.addr + mem.size ), mem.addr,
+                      &a[0], &b[0], offset, job.report );
+    }
+
+    if ( job.report.empty() )
+        job.report = "No differences\n";
+}
+
+// Find all pairs of desync dumps in a directory
+static vector<DiffJob> findJobs ( const string& dir )
+{
+    vector<DiffJob> jobs;
+
+    DIR *dp = opendir ( dir.c_str() );
+
+    if ( ! dp )
+        return jobs;
+
+    map<string, DiffJob> pairs;
+
+    while ( dirent *entry = readdir ( dp ) )
+    {
+        const string filename = entry->d_name;
+
+        if ( endsWith ( filename, DUMP_SUFFIX_P1 ) )
+        {
+            DiffJob& job = pairs [ filename.substr ( 0, filename.size() - sizeof ( DUMP_SUFFIX_P1 ) + 1 ) ];
+            job.fileA = dir + "/" + filename;
+        }
+        else if ( endsWith ( filename, DUMP_SUFFIX_P2 ) )
+        {
+            DiffJob& job = pairs [ filename.substr ( 0, filename.size() - sizeof ( DUMP_SUFFIX_P2 ) + 1 ) ];
+            job.fileB = dir + "/" + filename;
+        }
+    }
+
+    closedir ( dp );
+
+    for ( auto& kv : pairs )
+    {
+        if ( kv.second.fileA.empty() || kv.second.fileB.empty() )
+        {
+            PRINT ( "Missing pair for '%s'", kv.first );
+            continue;
+        }
+
+        kv.second.name = kv.first;
+        jobs.push_back ( kv.second );
+    }
+
+    return jobs;
+}
+
+
+// Worker thread that takes jobs from a shared list until there are none left
+class DiffThread : public Thread
+{
+public:
+
+    DiffThread ( vector<DiffJob>& jobs, size_t& next, Mutex& mutex ) : _jobs ( jobs ), _next ( next ), _mutex ( mutex ) {}
+
+    void run() override
+    {
+        for ( ;; )
+        {
+            size_t i;
+
+            {
+                LOCK ( _mutex );
+
+                if ( _next >= _jobs.size() )
+                    return;
+
+                i = _next++;
+            }
+
+            diffFiles ( _jobs[i] );
+        }
+    }
+
+private:
+
+    vector<DiffJob>& _jobs;
+    size_t& _next;
+    Mutex& _mutex;
+};
+
+
+int main ( int argc, char *argv[] )
+{
+    if ( argc < 3 )
+    {
+        PRINT ( "Usage: %s <rollback.bin> <a.dump> <b.dump>", argv[0] );
+        PRINT ( "       %s <rollback.bin> <directory> [threads]", argv[0] );
+        PRINT ( "" );
+        PRINT ( "Directory mode compares every pair of *" DUMP_SUFFIX_P1 " and *" DUMP_SUFFIX_P2 " files." );
+        return -1;
+    }
+
+    Logger::get().initialize ( LOG_FILE, 0 );
+
+    if ( ! allAddrs.load ( argv[1] ) || allAddrs.empty() )
+    {
+        PRINT ( "Failed to load '%s'", argv[1] );
+        Logger::get().deinitialize();
+        return -1;
+    }
+
+    vector<DiffJob> jobs;
+    size_t numThreads = DEFAULT_NUM_THREADS;
+
+    if ( argc >= 4 && endsWith ( argv[3], ".dump" ) )
+    {
+        DiffJob job;
+        job.name = argv[2];
+        job.fileA = argv[2];
+        job.fileB = argv[3];
+        jobs.push_back ( job );
+    }
+    else
+    {
+        jobs = findJobs ( argv[2] );
+
+        if ( argc >= 4 )
+            numThreads = max ( 1, atoi ( argv[3] ) );
+    }
+
+    numThreads = min ( numThreads, jobs.size() );
+
+    size_t next = 0;
+    Mutex mutex;
+    vector<shared_ptr<DiffThread>> threads;
+
+    for ( size_t i = 0; i < numThreads; ++i )
+    {
+        threads.push_back ( make_shared<DiffThread> ( jobs, next, mutex ) );
+        threads.back()->start();
+    }
+
+    for ( const auto& thread : threads )
+        thread->join();
+
+    for ( const DiffJob& job : jobs )
+        cout << job.name << ":" << endl << job.report << endl;
+
+    Logger::get().deinitialize();
+    return 0;
+}
@@ -0,0 +1,390 @@
+#include "MemDump.hpp"
+#include "MemCapture.hpp"
+#include "Thread.hpp"
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+
+#define LOG_FILE "mem_discover.log"
+
+// Default number of worker threads
+#define DEFAULT_NUM_THREADS ( 4 )
+
+// Default maximum gap of constant bytes that is merged into a range, to avoid lots of tiny ranges
+#define DEFAULT_MERGE_GAP ( 16 )
+
+// Ranges are extended to this alignment when the extra bytes are constant
+#define RANGE_ALIGNMENT ( 4 )
+
+// Number of bytes compared at once before comparing each byte
+#define COMPARE_BLOCK_SIZE ( 64 )
+
+// Byte classification flags
+#define CHANGED ( 0x1 ) // Changes between frames
+#define VOLATILE ( 0x2 ) // Differs between runs at the same frame
+
+
+// Each run is a capture file of the same memory range, captured while playing the same inputs
+static vector<string> runFiles;
+
+static MemCaptureHeader header;
+
+// Records of the first run, and the matching record of every other run, or SIZE_MAX if the frame is missing
+static vector<vector<size_t>> matchingRecords;
+
+
+// Flag every byte that differs between a and b
+static void flagDiffs ( const char *a, const char *b, size_t size, uint8_t flag, vector<uint8_t>& flags )
+{
+    for ( size_t i = 0; i < size; i += COMPARE_BLOCK_SIZE )
+    {
+        const size_t len = min<size_t> ( COMPARE_BLOCK_SIZE, size - i );
+
+        if ( memcmp ( a + i, b + i, len ) == 0 )
+            continue;
+
+        for ( size_t j = i; j < i + len; ++j )
+        {
+            if ( a[j] != b[j] )
+                flags[j] |= flag;
+        }
+    }
+}
+
+
+// Worker thread that classifies the bytes of a contiguous range of records of the first run
+class DiscoverThread : public Thread
+{
+public:
+
+    // Classification of each byte, only for the records handled by this thread
+    vector<uint8_t> flags;
+
+    // Number of records that couldn't be read
+    size_t numErrors = 0;
+
+    DiscoverThread ( size_t begin, size_t end ) : _begin ( begin ), _end ( end ) {}
+
+    void run() override
+    {
+        flags.resize ( header.size, 0 );
+
+        vector<unique_ptr<MemCaptureReader>> readers;
+
+        for ( const string& file : runFiles )
+        {
+            readers.push_back ( unique_ptr<MemCaptureReader> ( new MemCaptureReader() ) );
+            readers.back()->open ( file );
+        }
+
+        vector<char> prev ( header.size ), curr ( header.size ), other ( header.size );
+
+        // Start from the record before the range, so every change is counted exactly once
+        const size_t first = ( _begin > 0 ? _begin - 1 : 0 );
+
+        for ( size_t i = first; i < _end; ++i )
+        {
+            if ( ! readers[0]->readRecord ( i, &curr[0] ) )
+            {
+                ++numErrors;
+                continue;
+            }
+
+            if ( i > first )
+                flagDiffs ( &prev[0], &curr[0], header.size, CHANGED, flags );
+
+            if ( i >= _begin )
+            {
+                for ( size_t r = 1; r < readers.size(); ++r )
+                {
+                    const size_t j = matchingRecords[r][i];
+
+                    if ( j == SIZE_MAX )
+                        continue;
+
+                    if ( ! readers[r]->readRecord ( j, &other[0] ) )
+                    {
+                        ++numErrors;
+                        continue;
+                    }
+
+                    flagDiffs ( &curr[0], &other[0], header.size, VOLATILE, flags );
+                }
+            }
+
+            swap ( prev, curr );
+        }
+    }
+
+private:
+
+    size_t _begin, _end;
+};
+
+
+// Find the ranges of bytes that change deterministically, merging across small gaps of constant bytes
+static vector<pair<size_t, size_t>> findRanges ( const vector<uint8_t>& flags, size_t mergeGap )
+{
+    vector<pair<size_t, size_t>> ranges;
+
+    for ( size_t i = 0; i < flags.size(); )
+    {
+        if ( flags[i] != CHANGED )
+        {
+            ++i;
+            continue;
+        }
+
+        size_t start = i, end = i + 1;
+
+        for ( i = end; i < flags.size(); ++i )
+        {
+            if ( flags[i] == CHANGED )
+                end = i + 1;
+            else if ( flags[i] & VOLATILE || i - end >= mergeGap )
+                break;
+        }
+
+        // Extend to the alignment if the extra bytes are constant
+        while ( start % RANGE_ALIGNMENT && start > 0 && flags[start - 1] == 0 )
+            --start;
+
+        while ( end % RANGE_ALIGNMENT && end < flags.size() && flags[end] == 0 )
+            ++end;
+
+        if ( ! ranges.empty() && ranges.back().second >= start )
+            ranges.back().second = max ( ranges.back().second, end );
+        else
+            ranges.push_back ( make_pair ( start, end ) );
+
+        i = max ( i, end );
+    }
+
+    return ranges;
+}
+
+// Compare against existing rollback memory data, only the static ranges within the captured range can be compared
+static void compareExisting ( const string& filename, const vector<uint8_t>& flags )
+{
+    MemDumpList existing;
+
+    if ( ! existing.load ( filename ) || existing.empty() )
+    {
+        PRINT ( "Failed to load '%s'", filename );
+        return;
+    }
+
+    vector<bool> covered ( flags.size(), false );
+    size_t outside = 0, constant = 0, isVolatile = 0, pointers = 0;
+
+    for ( const MemDump& mem : existing.addrs )
+    {
+        pointers += mem.getTotalSize() - mem.size;
+
+        for ( size_t i = 0; i < mem.size; ++i )
+        {
+            const size_t offset = ( size_t ) mem.addr + i - header.addr;
+
+            if ( ( size_t ) mem.addr + i < header.addr || offset >= flags.size() )
+            {
+                ++outside;
+                continue;
+            }
+
+            covered[offset] = true;
+
+            if ( flags[offset] == 0 )
+                ++constant;
+            else if ( flags[offset] & VOLATILE )
+                ++isVolatile;
+        }
+    }
+
+    size_t missing = 0;
+    for ( size_t i = 0; i < flags.size(); ++i )
+    {
+        if ( flags[i] == CHANGED && ! covered[i] )
+            ++missing;
+    }
+
+    PRINT ( "Existing '%s': totalSize=%u", filename, existing.totalSize );
+    PRINT ( "  constant (possibly over-included): %u bytes", constant );
+    PRINT ( "  volatile: %u bytes", isVolatile );
+    PRINT ( "  outside the captured range: %u bytes; behind pointers: %u bytes", outside, pointers );
+    PRINT ( "Deterministic bytes not in existing (possible desyncs): %u bytes", missing );
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    string output, existing;
+    size_t numThreads = DEFAULT_NUM_THREADS, mergeGap = DEFAULT_MERGE_GAP;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg = argv[i];
+
+        if ( arg == "-t" && i + 1 < argc )
+            numThreads = max ( 1, atoi ( argv[++i] ) );
+        else if ( arg == "-g" && i + 1 < argc )
+            mergeGap = atoi ( argv[++i] );
+        else if ( arg == "-c" && i + 1 < argc )
+            existing = argv[++i];
+        else if ( output.empty() )
+            output = arg;
+        else
+            runFiles.push_back ( arg );
+    }
+
+    if ( output.empty() || runFiles.empty() )
+    {
+        PRINT ( "Usage: %s [-t threads] [-g gap] [-c rollback.bin] <output.bin> <capture> [capture ...]", argv[0] );
+        PRINT ( "" );
+        PRINT ( "Each capture is a run of the same inputs, bytes that differ between runs are excluded." );
+        PRINT ( "Constant gaps of up to 'gap' bytes are merged into ranges, defaults to %u.", DEFAULT_MERGE_GAP );
+        PRINT ( "Optionally compare against existing rollback memory data." );
+        return -1;
+    }
+
+    Logger::get().initialize ( LOG_FILE, 0 );
+
+    // Read the frames of each run, and match them to the records of the first run
+    matchingRecords.resize ( runFiles.size() );
+
+    vector<uint64_t> firstFrames;
+
+    for ( size_t r = 0; r < runFiles.size(); ++r )
+    {
+        MemCaptureReader reader;
+
+        if ( ! reader.open ( runFiles[r] ) )
+        {
+            PRINT ( "Failed to open '%s'", runFiles[r] );
+            Logger::get().deinitialize();
+            return -1;
+        }
+
+        if ( r == 0 )
+        {
+            header = reader.getHeader();
+            firstFrames = reader.getFrames();
+        }
+        else if ( reader.getHeader().addr != header.addr || reader.getHeader().size != header.size )
+        {
+            PRINT ( "'%s' captured a different memory range", runFiles[r] );
+            Logger::get().deinitialize();
+            return -1;
+        }
+
+        unordered_map<uint64_t, size_t> records;
+        for ( size_t i = 0; i < reader.getFrames().size(); ++i )
+            records[reader.getFrames()[i]] = i;
+
+        size_t matched = 0;
+        matchingRecords[r].resize ( firstFrames.size(), SIZE_MAX );
+
+        for ( size_t i = 0; i < firstFrames.size(); ++i )
+        {
+            const auto it = records.find ( firstFrames[i] );
+
+            if ( it == records.end() )
+                continue;
+
+            matchingRecords[r][i] = it->second;
+            ++matched;
+        }
+
+        PRINT ( "'%s': %u frames, %u matched", runFiles[r], reader.getFrames().size(), matched );
+    }
+
+    if ( firstFrames.size() < 2 )
+    {
+        PRINT ( "Not enough frames" );
+        Logger::get().deinitialize();
+        return -1;
+    }
+
+    // Split the records of the first run between the threads
+    numThreads = min ( numThreads, firstFrames.size() );
+
+    vector<shared_ptr<DiscoverThread>> threads;
+
+    for ( size_t i = 0; i < numThreads; ++i )
+    {
+        threads.push_back ( make_shared<DiscoverThread> ( firstFrames.size() * i / numThreads,
+                                                          firstFrames.size() * ( i + 1 ) / numThreads ) );
+        threads.back()->start();
+    }
+
+    vector<uint8_t> flags ( header.size, 0 );
+    size_t numErrors = 0;
+
+    for ( const auto& thread : threads )
+    {
+        thread->join();
+
+        for ( size_t i = 0; i < flags.size(); ++i )
+            flags[i] |= thread->flags[i];
+
+        numErrors += thread->numErrors;
+    }
+
+    if ( numErrors )
+        PRINT ( "Failed to read %u records", numErrors );
+
+    // Size report
+    size_t constant = 0, deterministic = 0, isVolatile = 0;
+
+    for ( uint8_t flag : flags )
+    {
+        if ( flag == 0 )
+            ++constant;
+        else if ( flag & VOLATILE )
+            ++isVolatile;
+        else
+            ++deterministic;
+    }
+
+    PRINT ( "Captured 0x%08X - 0x%08X: %u bytes", header.addr, header.addr + header.size, header.size );
+    PRINT ( "  constant: %u bytes", constant );
+    PRINT ( "  deterministic: %u bytes", deterministic );
+    PRINT ( "  volatile: %u bytes%s", isVolatile, ( runFiles.size() < 2 ? " (needs at least 2 runs)" : "" ) );
+
+    const vector<pair<size_t, size_t>> ranges = findRanges ( flags, mergeGap );
+
+    if ( ranges.empty() )
+    {
+        PRINT ( "No deterministic ranges discovered" );
+        Logger::get().deinitialize();
+        return -1;
+    }
+
+    MemDumpList allAddrs;
+
+    for ( const auto& range : ranges )
+    {
+        allAddrs.append ( MemDump ( ( char * ) ( size_t ) header.addr + range.first, range.second - range.first ) );
+        LOG ( "{ 0x%06X, 0x%06X }", header.addr + range.first, header.addr + range.second );
+    }
+
+    allAddrs.update();
+
+    PRINT ( "Discovered %u ranges, totalSize=%u", allAddrs.addrs.size(), allAddrs.totalSize );
+
+    if ( ! existing.empty() )
+        compareExisting ( existing, flags );
+
+    const bool success = allAddrs.save ( output );
+
+    if ( ! success )
+        PRINT ( "Failed to save '%s'", output );
+
+    Logger::get().deinitialize();
+    return ( success ? 0 : -1 );
+}
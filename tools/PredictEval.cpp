@@ -0,0 +1,166 @@
+#include "InputPredictor.hpp"
+#include "ReplayManager.hpp"
+#include "Exceptions.hpp"
+#include "Constants.hpp"
+#include "Logger.hpp"
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+
+#define LOG_FILE "predict_eval.log"
+
+// Default number of frames it takes for the remote inputs to arrive
+#define DEFAULT_LATENCY ( 4 )
+
+
+// Rollback statistics of a prediction strategy
+struct Score
+{
+    size_t frames = 0, rollbacks = 0, rollbackFrames = 0;
+};
+
+
+// Simulate receiving the inputs of a player latency frames late, and count the rollbacks caused by the predictions.
+// Predictions are kept until the actual input arrives, and are predicted again after a rollback, like NetplayManager.
+static void evaluate ( const vector<uint16_t>& inputs, uint32_t latency, InputPredictor& predictor, Score& score )
+{
+    vector<uint16_t> predicted;
+    size_t known = 0;
+
+    for ( size_t frame = 0; frame < inputs.size() + latency; ++frame )
+    {
+        // The input for this frame arrives
+        if ( frame >= latency && frame - latency < inputs.size() )
+        {
+            const size_t arrived = frame - latency;
+
+            if ( arrived < known + predicted.size() && predicted[arrived - known] != inputs[arrived] )
+            {
+                ++score.rollbacks;
+                score.rollbackFrames += frame - arrived;
+
+                predicted.resize ( arrived - known + 1 );
+            }
+
+            if ( ! predicted.empty() )
+                predicted.erase ( predicted.begin() );
+
+            if ( arrived > 0 )
+                predictor.update ( inputs[arrived - 1], inputs[arrived] );
+
+            known = arrived + 1;
+        }
+
+        if ( frame >= inputs.size() )
+            continue;
+
+        // Predict up to the frame that is about to run
+        const uint16_t last = ( known ? inputs[known - 1] : 0 );
+
+        for ( size_t f = known + predicted.size(); f <= frame; ++f )
+            predicted.push_back ( predictor.predict ( last, f + 1 - known ) );
+
+        ++score.frames;
+    }
+}
+
+
+int main ( int argc, char *argv[] )
+{
+    uint32_t latency = DEFAULT_LATENCY;
+    vector<string> files;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        const string arg = argv[i];
+
+        if ( arg == "-l" && i + 1 < argc )
+            latency = max ( 1, atoi ( argv[++i] ) );
+        else
+            files.push_back ( arg );
+    }
+
+    if ( files.empty() )
+    {
+        PRINT ( "Usage: %s [-l latency] <replay or sync log> [...]", argv[0] );
+        PRINT ( "" );
+        PRINT ( "Scores each input prediction strategy by the rollbacks it would cause," );
+        PRINT ( "if each player's inputs arrived 'latency' frames late, defaults to %u.", DEFAULT_LATENCY );
+        return -1;
+    }
+
+    Logger::get().initialize ( LOG_FILE, 0 );
+
+    const vector<InputPrediction> types =
+    {
+        InputPrediction::HoldLast, InputPrediction::ReleaseButtons, InputPrediction::Frequency
+    };
+
+    vector<Score> scores ( types.size() );
+
+    for ( const string& file : files )
+    {
+        ReplayManager replay;
+
+        try
+        {
+            if ( ! replay.load ( file, true ) )
+            {
+                PRINT ( "Failed to load '%s'", file );
+                continue;
+            }
+        }
+        catch ( const Exception& exc )
+        {
+            PRINT ( "Failed to load '%s': %s", file, exc.user );
+            continue;
+        }
+
+        // Each player is evaluated as the remote player, learning across the whole file
+        for ( uint8_t player = 1; player <= 2; ++player )
+        {
+            vector<shared_ptr<InputPredictor>> predictors;
+
+            for ( const InputPrediction& type : types )
+                predictors.push_back ( InputPredictor::create ( type ) );
+
+            for ( uint32_t index = 0; index <= replay.getLastIndex(); ++index )
+            {
+                if ( replay.getGameMode ( {{ 0, index }} ) != CC_GAME_MODE_IN_GAME )
+                    continue;
+
+                vector<uint16_t> inputs ( replay.getEndFrame ( index ) );
+
+                for ( uint32_t frame = 0; frame < inputs.size(); ++frame )
+                {
+                    const ReplayManager::Inputs& both = replay.getInputs ( {{ frame, index }} );
+                    inputs[frame] = ( player == 1 ? both.p1 : both.p2 );
+                }
+
+                for ( size_t i = 0; i < types.size(); ++i )
+                    evaluate ( inputs, latency, *predictors[i], scores[i] );
+            }
+        }
+    }
+
+    PRINT ( "latency=%u frames", latency );
+
+    for ( size_t i = 0; i < types.size(); ++i )
+    {
+        const Score& score = scores[i];
+
+        if ( ! score.frames )
+            continue;
+
+        PRINT ( "%s: frames=%u; rollbacks=%u (%.2f per 100 frames); average depth=%.2f",
+                types[i], score.frames, score.rollbacks, 100.0 * score.rollbacks / score.frames,
+                ( score.rollbacks ? double ( score.rollbackFrames ) / score.rollbacks : 0.0 ) );
+    }
+
+    Logger::get().deinitialize();
+    return 0;
+}